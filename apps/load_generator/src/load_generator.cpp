@@ -0,0 +1,340 @@
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QHostAddress>
+#include <QThread>
+#include <QTimer>
+#include <algorithm>
+#include <memory>
+#include <vector>
+#include "client.hpp"
+#include "payload.hpp"
+#include "value_validator.hpp"
+
+// Spins up N clients with M options and parameters each, every option
+// wired to its parameter like echo does. A driver connection publishes
+// /set messages carrying a sequence number and times how long it takes
+// until the matching parameter comes back: the round trip through the
+// broker, the client's receive path and its publish path.
+
+namespace {
+
+using SideAssist::Qt::Client;
+using SideAssist::Qt::NamedValue;
+namespace Payload = SideAssist::Qt::Payload;
+namespace Validator = SideAssist::Qt::ValueValidator;
+
+struct Config {
+  QHostAddress host;
+  quint16 port;
+  QString username;
+  QByteArray password;
+  int clients;
+  int values;
+  int threads;
+  double set_rate;     // /set per second over all clients
+  double update_rate;  // Local parameter updates per second per client
+  int duration;        // Seconds
+  quint8 qos;
+};
+
+QString clientId(int client) {
+  return "load_" + QString::number(client);
+}
+
+// Clients of one thread, created and driven on that thread
+class Worker : public QObject {
+ public:
+  Worker(const Config& config, int first_client, int client_count)
+      : config_(config) {
+    auto validator = std::make_shared<Validator::SingleType>(
+        Validator::ValueTypeFieldEnum::Integer);
+    QStringList option_names, parameter_names;
+    for (int v = 0; v < config.values; ++v) {
+      option_names.append("opt_" + QString::number(v));
+      parameter_names.append("param_" + QString::number(v));
+    }
+    for (int c = first_client; c < first_client + client_count; ++c) {
+      auto client = std::make_unique<Client>(config.host, config.port);
+      client->setClientId(clientId(c));
+      client->setUsername(config.username);
+      client->setPassword(config.password);
+      auto options = client->addOptions(option_names, false);
+      auto parameters = client->addParameters(parameter_names);
+      for (int v = 0; v < config.values; ++v) {
+        options[v]->setValidator(validator);
+        connect(options[v].get(), &NamedValue::valueChanged,
+                parameters[v].get(), &NamedValue::setValue);
+      }
+      auto update = client->addParameter("update");
+      update->setValue(0);
+      updates_.push_back(std::move(update));
+      client->connectToHost();
+      clients_.push_back(std::move(client));
+    }
+    if (config.update_rate > 0) {
+      connect(&update_timer_, &QTimer::timeout, this, &Worker::update);
+      update_timer_.start(1);
+      clock_.start();
+    }
+  }
+
+  int connectedCount() const {
+    return int(std::count_if(clients_.begin(), clients_.end(), [](auto& c) {
+      return c->connectionState() == Client::ConnectionState::Connected;
+    }));
+  }
+
+  // Published and received messages of every client
+  std::pair<quint64, quint64> messageCounts() const {
+    using TopicClass = SideAssist::Qt::ClientMetrics::TopicClass;
+    quint64 published = 0, received = 0;
+    for (auto& client : clients_) {
+      const auto& metrics = client->metrics();
+      for (int i = 0; i < metrics.topic_class_count; ++i) {
+        published += metrics.published(TopicClass(i));
+        received += metrics.received(TopicClass(i));
+      }
+    }
+    return {published, received};
+  }
+
+ private:
+  void update() {
+    // Catch up to the configured rate, however late the timer fires
+    auto target = quint64(double(clock_.elapsed()) / 1000.0 *
+                          config_.update_rate * double(updates_.size()));
+    for (; update_count_ < target; ++update_count_) {
+      auto& value = updates_[update_count_ % updates_.size()];
+      value->setValue(qint64(update_count_));
+    }
+  }
+
+  const Config config_;
+  std::vector<std::unique_ptr<Client> > clients_;
+  std::vector<std::shared_ptr<NamedValue> > updates_;
+  QTimer update_timer_;
+  QElapsedTimer clock_;
+  quint64 update_count_ = 0;
+};
+
+// Publishes /set and measures round trips from a plain MQTT connection
+class Driver : public QObject {
+ public:
+  explicit Driver(const Config& config)
+      : config_(config), mqtt_(config.host, config.port) {
+    mqtt_.setClientId("load_driver");
+    mqtt_.setUsername(config.username);
+    mqtt_.setPassword(config.password);
+    mqtt_.setCleanSession(true);
+    connect(&mqtt_, &QMQTT::Client::connected, this, [this]() {
+      mqtt_.subscribe("side_assist/+/param/+", config_.qos);
+    });
+    connect(&mqtt_, &QMQTT::Client::subscribed, this,
+            [this]() { subscribed_ = true; });
+    connect(&mqtt_, &QMQTT::Client::received, this, &Driver::receive);
+    connect(&send_timer_, &QTimer::timeout, this, &Driver::send);
+    mqtt_.connectToHost();
+  }
+
+  bool ready() const { return subscribed_; }
+
+  void start() {
+    clock_.start();
+    send_timer_.start(1);
+  }
+  void stop() { send_timer_.stop(); }
+
+  quint64 sent() const { return next_sequence_; }
+  quint64 received() const { return latencies_.size(); }
+
+  void report() {
+    std::vector<qint64> latencies = latencies_;
+    std::sort(latencies.begin(), latencies.end());
+    auto percentile = [&latencies](double p) {
+      if (latencies.empty())
+        return 0.0;
+      auto index = size_t(p * double(latencies.size() - 1));
+      return double(latencies[index]) / 1000.0;
+    };
+    // Changes a client coalesced into one publish count as lost
+    qInfo("Round trips: %llu of %llu /set (%llu lost or in flight)",
+          quint64(latencies.size()), next_sequence_,
+          next_sequence_ - quint64(latencies.size()));
+    qInfo("Latency (us): p50 %.1f, p99 %.1f, p999 %.1f, max %.1f",
+          percentile(0.5), percentile(0.99), percentile(0.999),
+          percentile(1.0));
+  }
+
+ private:
+  void send() {
+    auto target =
+        quint64(double(clock_.elapsed()) / 1000.0 * config_.set_rate);
+    const quint64 targets = quint64(config_.clients) * quint64(config_.values);
+    QByteArray payload;
+    for (; next_sequence_ < target; ++next_sequence_) {
+      // Round robin over every option of every client
+      quint64 target_index = next_sequence_ % targets;
+      QString topic =
+          "side_assist/" + clientId(int(target_index / config_.values)) +
+          "/option/opt_" + QString::number(target_index % config_.values) +
+          "/set";
+      Payload::writeValue(qint64(next_sequence_), payload);
+      sent_at_.push_back(clock_.nsecsElapsed());
+      mqtt_.publish(QMQTT::Message(0, topic, payload, config_.qos));
+    }
+  }
+
+  void receive(const QMQTT::Message& message) {
+    const qint64 now = clock_.nsecsElapsed();
+    // param/update and retained values from earlier runs are no round trip
+    if (!message.topic().contains("/param/param_") || message.retain())
+      return;
+    QJsonValue value;
+    if (!Payload::readValue(message.payload(), value) || !value.isDouble())
+      return;
+    auto sequence = value.toInteger(-1);
+    if (sequence < 0 || quint64(sequence) >= sent_at_.size())
+      return;
+    latencies_.push_back(now - sent_at_[size_t(sequence)]);
+  }
+
+  const Config config_;
+  QMQTT::Client mqtt_;
+  QTimer send_timer_;
+  QElapsedTimer clock_;
+  bool subscribed_ = false;
+  quint64 next_sequence_ = 0;
+  std::vector<qint64> sent_at_;   // Indexed by sequence number
+  std::vector<qint64> latencies_;  // ns
+};
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  QCoreApplication app(argc, argv);
+
+  QCommandLineParser parser;
+  parser.setApplicationDescription(
+      "Stress a broker with many side_assist clients and report /set round "
+      "trip latency.");
+  parser.addHelpOption();
+  parser.addOptions({
+      {"host", "Broker address.", "address", "127.0.0.1"},
+      {"port", "Broker port.", "port", "1883"},
+      {"username", "Username for every connection.", "name"},
+      {"password", "Password for every connection.", "password"},
+      {"clients", "Number of clients.", "n", "10"},
+      {"values", "Options and parameters per client.", "m", "10"},
+      {"threads", "Threads the clients are spread over.", "n", "1"},
+      {"set-rate", "/set messages per second, over all clients.", "rate",
+       "1000"},
+      {"update-rate", "Parameter updates per second, per client.", "rate",
+       "0"},
+      {"duration", "Seconds to run after every client connected.", "s",
+       "30"},
+      {"qos", "QoS of /set messages and the driver subscription.", "qos",
+       "1"},
+  });
+  parser.process(app);
+
+  Config config;
+  config.host = QHostAddress(parser.value("host"));
+  config.port = quint16(parser.value("port").toUInt());
+  config.username = parser.value("username");
+  config.password = parser.value("password").toUtf8();
+  config.clients = qMax(parser.value("clients").toInt(), 1);
+  config.values = qMax(parser.value("values").toInt(), 1);
+  config.threads = qBound(1, parser.value("threads").toInt(), config.clients);
+  config.set_rate = parser.value("set-rate").toDouble();
+  config.update_rate = parser.value("update-rate").toDouble();
+  config.duration = qMax(parser.value("duration").toInt(), 1);
+  config.qos = quint8(qBound(0, parser.value("qos").toInt(), 2));
+
+  // Workers are created on, and stay on, their own threads
+  std::vector<std::unique_ptr<QThread> > threads;
+  std::vector<Worker*> workers;
+  for (int t = 0; t < config.threads; ++t) {
+    int first = config.clients * t / config.threads;
+    int count = config.clients * (t + 1) / config.threads - first;
+    auto thread = std::make_unique<QThread>();
+    thread->start();
+    Worker* worker = nullptr;
+    auto* context = new QObject;
+    context->moveToThread(thread.get());
+    QMetaObject::invokeMethod(
+        context, [&]() { worker = new Worker(config, first, count); },
+        Qt::BlockingQueuedConnection);
+    context->deleteLater();
+    QObject::connect(thread.get(), &QThread::finished, worker,
+                     &QObject::deleteLater);
+    workers.push_back(worker);
+    threads.push_back(std::move(thread));
+  }
+  Driver driver(config);
+
+  auto connected = [&workers]() {
+    int count = 0;
+    for (auto* worker : workers) {
+      QMetaObject::invokeMethod(
+          worker, [&]() { count += worker->connectedCount(); },
+          Qt::BlockingQueuedConnection);
+    }
+    return count;
+  };
+  auto messages = [&workers]() {
+    quint64 published = 0, received = 0;
+    for (auto* worker : workers) {
+      QMetaObject::invokeMethod(
+          worker,
+          [&]() {
+            auto [p, r] = worker->messageCounts();
+            published += p;
+            received += r;
+          },
+          Qt::BlockingQueuedConnection);
+    }
+    return std::make_pair(published, received);
+  };
+
+  QElapsedTimer run_clock;
+  quint64 last_round_trips = 0, last_published = 0;
+  int elapsed_seconds = 0;
+  QTimer tick;
+  QObject::connect(&tick, &QTimer::timeout, [&]() {
+    if (!run_clock.isValid()) {
+      int count = connected();
+      qInfo("%d of %d clients connected", count, config.clients);
+      if (count < config.clients || !driver.ready())
+        return;
+      driver.start();
+      run_clock.start();
+      return;
+    }
+    auto [published, received] = messages();
+    qInfo("%3ds: %llu /set/s sent, %llu round trips/s, %llu client "
+          "publishes/s, %llu client receives total",
+          ++elapsed_seconds, driver.sent() / quint64(elapsed_seconds),
+          driver.received() - last_round_trips, published - last_published,
+          received);
+    last_round_trips = driver.received();
+    last_published = published;
+    if (elapsed_seconds < config.duration)
+      return;
+    driver.stop();
+    tick.stop();
+    // Let in-flight round trips arrive
+    QTimer::singleShot(1000, &app, [&]() {
+      driver.report();
+      app.quit();
+    });
+  });
+  tick.start(1000);
+
+  int ret = app.exec();
+  for (auto& thread : threads) {
+    thread->quit();
+    thread->wait();
+  }
+  return ret;
+}
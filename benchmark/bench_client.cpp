@@ -0,0 +1,104 @@
+#include <benchmark/benchmark.h>
+#include <QCoreApplication>
+#include <QEvent>
+#include <QMetaObject>
+#include <QStringList>
+#include "client.hpp"
+#include "payload.hpp"
+#include "value_validator.hpp"
+
+namespace Validator = SideAssist::Qt::ValueValidator;
+
+namespace {
+
+QCoreApplication& application() {
+  static int argc = 1;
+  static char name[] = "SideAssist.Benchmark";
+  static char* argv[] = {name, nullptr};
+  static QCoreApplication app(argc, argv);
+  return app;
+}
+
+// A client that never connects, and uploads stop at the connection check.
+// handleMessage() only routes and queues a remote change, apply() then
+// runs the queued parse, validation and setValue().
+struct ClientFixture {
+  explicit ClientFixture(int option_count) {
+    application();
+    client.setClientId("bench");
+    QStringList names;
+    for (int i = 0; i < option_count; ++i)
+      names.append("option_" + QString::number(i));
+    auto validator = std::make_shared<Validator::SingleType>(
+        Validator::ValueTypeFieldEnum::Integer);
+    for (auto& option : client.addOptions(names, false))
+      option->setValidator(validator);
+  }
+
+  void handle(const QMQTT::Message& message) {
+    // handleMessage is a private slot
+    QMetaObject::invokeMethod(&client, "handleMessage", ::Qt::DirectConnection,
+                              Q_ARG(QMQTT::Message, message));
+  }
+
+  // Runs the queued drainInboundQueues()
+  void apply() {
+    QCoreApplication::sendPostedEvents(&client, QEvent::MetaCall);
+  }
+
+  SideAssist::Qt::Client client;
+};
+
+QMQTT::Message makeSet(int option, int value) {
+  QByteArray payload;
+  SideAssist::Qt::Payload::writeValue(value, payload);
+  return QMQTT::Message(0,
+                        "side_assist/bench/option/option_" +
+                            QString::number(option) + "/set",
+                        payload, 2);
+}
+
+}  // namespace
+
+static void BM_HandleMessageSet(benchmark::State& state) {
+  const int option_count = int(state.range(0));
+  ClientFixture fixture(option_count);
+  // Two rounds over the same options with different values, alternated so
+  // every message changes its option even when each option is hit once
+  // per round
+  std::vector<QMQTT::Message> messages;
+  for (int round = 0; round < 2; ++round) {
+    for (int i = 0; i < 256; ++i)
+      messages.push_back(makeSet(i * 7919 % option_count, round * 256 + i));
+  }
+  size_t i = 0;
+  for (auto _ : state) {
+    fixture.handle(messages[i++ % messages.size()]);
+    fixture.apply();
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_HandleMessageSet)->Arg(16)->Arg(1024)->Arg(16384);
+
+static void BM_HandleMessageUnknownTopic(benchmark::State& state) {
+  ClientFixture fixture(int(state.range(0)));
+  QByteArray payload;
+  SideAssist::Qt::Payload::writeValue(1, payload);
+  QMQTT::Message message(0, "side_assist/bench/option/missing/set", payload);
+  for (auto _ : state)
+    fixture.handle(message);
+}
+BENCHMARK(BM_HandleMessageUnknownTopic)->Arg(1024);
+
+// Goes through the installed messageHandler, which writes every line to
+// stderr and to log/bench.log: run with 2>/dev/null
+static void BM_DefaultMessageHandler(benchmark::State& state) {
+  static ClientFixture* fixture = [] {
+    auto* fixture = new ClientFixture(0);
+    fixture->client.installDefaultMessageHandler();
+    return fixture;
+  }();
+  for (auto _ : state)
+    qInfo("Uploading option %s...", "option_0");
+}
+BENCHMARK(BM_DefaultMessageHandler);
@@ -0,0 +1,76 @@
+#include <benchmark/benchmark.h>
+#include <QReadLocker>
+#include <QReadWriteLock>
+#include <map>
+#include <vector>
+#include "named_value_registry.hpp"
+
+namespace {
+
+constexpr int value_count = 4096;
+
+std::vector<QString> makeNames() {
+  std::vector<QString> names;
+  for (int i = 0; i < value_count; ++i)
+    names.push_back("value_" + QString::number(i));
+  return names;
+}
+
+const std::vector<QString>& names() {
+  static const auto names = makeNames();
+  return names;
+}
+
+// What Client used before NamedValueRegistry
+struct LockedMap {
+  LockedMap() {
+    for (const auto& name : names())
+      map.emplace(name, std::make_shared<SideAssist::Qt::NamedValue>(
+                            name, QJsonValue(QJsonValue::Undefined)));
+  }
+
+  std::shared_ptr<SideAssist::Qt::NamedValue> find(const QString& name) {
+    QReadLocker lock(&this->lock);
+    auto itr = map.find(name);
+    return itr == map.end() ? nullptr : itr->second;
+  }
+
+  std::map<QString, std::shared_ptr<SideAssist::Qt::NamedValue> > map;
+  QReadWriteLock lock;
+};
+
+struct Registry {
+  Registry() {
+    for (const auto& name : names())
+      registry.emplace(name, std::make_shared<SideAssist::Qt::NamedValue>(
+                                 name, QJsonValue(QJsonValue::Undefined)));
+  }
+
+  SideAssist::Qt::NamedValueRegistry registry;
+};
+
+}  // namespace
+
+static void BM_LockedMapLookup(benchmark::State& state) {
+  static LockedMap map;
+  const auto& keys = names();
+  size_t i = state.thread_index() * 97;
+  for (auto _ : state) {
+    // Same copy of the shared_ptr as Client::option() returns
+    benchmark::DoNotOptimize(map.find(keys[i++ % value_count]));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_LockedMapLookup)->ThreadRange(1, 32)->UseRealTime();
+
+static void BM_RegistryLookup(benchmark::State& state) {
+  static Registry registry;
+  const auto& keys = names();
+  size_t i = state.thread_index() * 97;
+  for (auto _ : state) {
+    auto* ptr = registry.registry.find(keys[i++ % value_count]);
+    benchmark::DoNotOptimize(ptr == nullptr ? nullptr : *ptr);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_RegistryLookup)->ThreadRange(1, 32)->UseRealTime();
@@ -0,0 +1,81 @@
+#include <benchmark/benchmark.h>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include "payload.hpp"
+
+namespace Payload = SideAssist::Qt::Payload;
+
+namespace {
+
+QJsonValue makeValue(int kind) {
+  switch (kind) {
+    case 0:
+      return 42;
+    case 1:
+      return 3.14159;
+    case 2:
+      return QStringLiteral("/home/user/screenshots/2023-01-01 \"shot\".png");
+    default: {
+      QJsonObject object;
+      for (int i = 0; i < 32; ++i)
+        object.insert("key_" + QString::number(i),
+                      QJsonArray({i, double(i) / 3, QString::number(i)}));
+      return object;
+    }
+  }
+}
+
+}  // namespace
+
+static void BM_WriteValue(benchmark::State& state) {
+  auto value = makeValue(int(state.range(0)));
+  auto encoding = Payload::Encoding(state.range(1));
+  QByteArray buffer;
+  for (auto _ : state) {
+    Payload::writeValue(value, buffer, encoding);
+    benchmark::DoNotOptimize(buffer.data());
+  }
+}
+BENCHMARK(BM_WriteValue)
+    ->ArgsProduct({{0, 1, 2, 3},
+                   {int(Payload::Encoding::Json),
+                    int(Payload::Encoding::Cbor)}});
+
+static void BM_ReadValue(benchmark::State& state) {
+  QByteArray payload;
+  Payload::writeValue(makeValue(int(state.range(0))), payload,
+                      Payload::Encoding(state.range(1)));
+  QJsonValue value;
+  for (auto _ : state) {
+    Payload::readValue(payload, value);
+    benchmark::DoNotOptimize(value);
+  }
+}
+BENCHMARK(BM_ReadValue)
+    ->ArgsProduct({{0, 1, 2, 3},
+                   {int(Payload::Encoding::Json),
+                    int(Payload::Encoding::Cbor)}});
+
+// What readValue() did for every JSON payload before the scalar fast path
+static void BM_ReadScalarDocument(benchmark::State& state) {
+  QByteArray payload;
+  Payload::writeValue(makeValue(int(state.range(0))), payload);
+  QJsonValue value;
+  for (auto _ : state) {
+    value = QJsonDocument::fromJson(payload)["value"];
+    benchmark::DoNotOptimize(value);
+  }
+}
+BENCHMARK(BM_ReadScalarDocument)->DenseRange(0, 2);
+
+static void BM_ReadScalarFastPath(benchmark::State& state) {
+  QByteArray payload;
+  Payload::writeValue(makeValue(int(state.range(0))), payload);
+  QJsonValue value;
+  for (auto _ : state) {
+    Payload::readScalarValue(payload, value);
+    benchmark::DoNotOptimize(value);
+  }
+}
+BENCHMARK(BM_ReadScalarFastPath)->DenseRange(0, 2);
@@ -0,0 +1,236 @@
+#include <benchmark/benchmark.h>
+#include <QJsonArray>
+#include <QJsonObject>
+#include "value_validator.hpp"
+
+namespace Validator = SideAssist::Qt::ValueValidator;
+
+namespace {
+
+std::set<QString> makeWords(const QString& prefix, int count) {
+  std::set<QString> words;
+  for (int i = 0; i < count; ++i)
+    words.insert(prefix + QString::number(i));
+  return words;
+}
+
+QJsonArray makeList(int size) {
+  QJsonArray list;
+  for (int i = 0; i < size; ++i)
+    list.append(i);
+  return list;
+}
+
+// {"all": [{"types": [...]}, {"any": [..., {"all": ...}]}]} nested depth
+// times, with a list item and an option set at every level
+QJsonValue makeDeepTree(int depth) {
+  QJsonValue tree = QJsonObject({{"types", QJsonArray({"Integer", "Null"})}});
+  for (int i = 0; i < depth; ++i) {
+    QJsonArray options;
+    for (const auto& word : makeWords("opt", 8))
+      options.append(word);
+    tree = QJsonObject(
+        {{"all",
+          QJsonArray({QJsonObject({{"types", QJsonArray({"Array", "Null"})}}),
+                      QJsonObject({{"any",
+                                    QJsonArray({QJsonObject(
+                                                    {{"options", options}}),
+                                                QJsonObject(
+                                                    {{"list", tree}})})}})})}});
+  }
+  return tree;
+}
+
+// [[cell, ...], ...] where a cell is null, an integer, an option or a
+// .txt path under /tmp/
+std::shared_ptr<Validator::Abstract> makeTableValidator() {
+  using List = std::list<std::shared_ptr<Validator::Abstract>>;
+  auto cell = std::make_shared<Validator::Any>(List{
+      std::make_shared<Validator::SingleType>(
+          Validator::ValueTypeFieldEnum::Null),
+      std::make_shared<Validator::SingleType>(
+          Validator::ValueTypeFieldEnum::Integer),
+      std::make_shared<Validator::Option>(makeWords("opt", 8)),
+      std::make_shared<Validator::All>(List{
+          std::make_shared<Validator::StringPrefix>(std::set<QString>{"/tmp/"}),
+          std::make_shared<Validator::StringSuffix>(
+              std::set<QString>{".txt"})})});
+  return std::make_shared<Validator::ListItem>(
+      std::make_shared<Validator::ListItem>(cell));
+}
+
+QJsonArray makeTable(int rows) {
+  QJsonArray table;
+  for (int i = 0; i < rows; ++i) {
+    QJsonArray row;
+    for (int j = 0; j < 4; ++j) {
+      row.append(QJsonValue());
+      row.append(i * 4 + j);
+      row.append("opt" + QString::number(j));
+      row.append("/tmp/" + QString::number(j) + ".txt");
+    }
+    table.append(row);
+  }
+  return table;
+}
+
+}  // namespace
+
+static void BM_ValidateDummy(benchmark::State& state) {
+  Validator::Dummy validator;
+  QJsonValue value(42);
+  for (auto _ : state)
+    benchmark::DoNotOptimize(validator.validate(value));
+}
+BENCHMARK(BM_ValidateDummy);
+
+static void BM_ValidateSingleType(benchmark::State& state) {
+  Validator::SingleType validator(Validator::ValueTypeFieldEnum::Integer);
+  QJsonValue value(42);
+  for (auto _ : state)
+    benchmark::DoNotOptimize(validator.validate(value));
+}
+BENCHMARK(BM_ValidateSingleType);
+
+static void BM_ValidateTypes(benchmark::State& state) {
+  Validator::Types validator({QJsonValue::Null, QJsonValue::String});
+  QJsonValue value("a string value");
+  for (auto _ : state)
+    benchmark::DoNotOptimize(validator.validate(value));
+}
+BENCHMARK(BM_ValidateTypes);
+
+static void BM_ValidatePath(benchmark::State& state) {
+  auto validator = Validator::Path::OpenFile();
+  QJsonValue value(QStringLiteral(__FILE__));
+  for (auto _ : state)
+    benchmark::DoNotOptimize(validator->validate(value));
+}
+BENCHMARK(BM_ValidatePath);
+
+static void BM_ValidateOption(benchmark::State& state) {
+  Validator::Option validator(makeWords("option_", int(state.range(0))));
+  QJsonValue value("option_" + QString::number(state.range(0) / 2));
+  for (auto _ : state)
+    benchmark::DoNotOptimize(validator.validate(value));
+}
+BENCHMARK(BM_ValidateOption)->Arg(4)->Arg(64)->Arg(1024);
+
+static void BM_ValidateStringPrefix(benchmark::State& state) {
+  Validator::StringPrefix validator(makeWords("/prefix_", int(state.range(0))));
+  QJsonValue value("/prefix_1/some/longer/path");
+  for (auto _ : state)
+    benchmark::DoNotOptimize(validator.validate(value));
+}
+BENCHMARK(BM_ValidateStringPrefix)->Arg(4)->Arg(64);
+
+static void BM_ValidateStringSuffix(benchmark::State& state) {
+  Validator::StringSuffix validator(makeWords(".ext", int(state.range(0))));
+  QJsonValue value("some/longer/path/file.ext1");
+  for (auto _ : state)
+    benchmark::DoNotOptimize(validator.validate(value));
+}
+BENCHMARK(BM_ValidateStringSuffix)->Arg(4)->Arg(64);
+
+static void BM_ValidateAnyAll(benchmark::State& state) {
+  auto integer = std::make_shared<Validator::SingleType>(
+      Validator::ValueTypeFieldEnum::Integer);
+  auto null = std::make_shared<Validator::SingleType>(
+      Validator::ValueTypeFieldEnum::Null);
+  Validator::All validator({std::make_shared<Validator::Any>(
+                                std::list<std::shared_ptr<Validator::Abstract>>{
+                                    null, integer}),
+                            integer});
+  QJsonValue value(42);
+  for (auto _ : state)
+    benchmark::DoNotOptimize(validator.validate(value));
+}
+BENCHMARK(BM_ValidateAnyAll);
+
+static void BM_ValidateListItem(benchmark::State& state) {
+  Validator::ListItem validator(std::make_shared<Validator::SingleType>(
+      Validator::ValueTypeFieldEnum::Integer));
+  QJsonValue value(makeList(int(state.range(0))));
+  for (auto _ : state)
+    benchmark::DoNotOptimize(validator.validate(value));
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_ValidateListItem)->Arg(16)->Arg(1024);
+
+static void BM_ValidateDeepTree(benchmark::State& state) {
+  auto validator = Validator::Abstract::deserializeFromJson(
+      makeDeepTree(int(state.range(0))));
+  // Matches the innermost integer through every list level
+  QJsonValue value(42);
+  for (int i = 0; i < state.range(0); ++i)
+    value = QJsonArray({value});
+  for (auto _ : state)
+    benchmark::DoNotOptimize(validator->validate(value));
+}
+BENCHMARK(BM_ValidateDeepTree)->Arg(4)->Arg(16);
+
+static void BM_ValidateDeepTreeProgram(benchmark::State& state) {
+  auto validator = Validator::Abstract::deserializeFromJson(
+      makeDeepTree(int(state.range(0))));
+  const auto& program = validator->program();
+  QJsonValue value(42);
+  for (int i = 0; i < state.range(0); ++i)
+    value = QJsonArray({value});
+  for (auto _ : state)
+    benchmark::DoNotOptimize(program.run(value));
+}
+BENCHMARK(BM_ValidateDeepTreeProgram)->Arg(4)->Arg(16);
+
+static void BM_ValidateTable(benchmark::State& state) {
+  auto validator = makeTableValidator();
+  QJsonValue value(makeTable(int(state.range(0))));
+  for (auto _ : state)
+    benchmark::DoNotOptimize(validator->validate(value));
+  state.SetItemsProcessed(state.iterations() * state.range(0) * 16);
+}
+BENCHMARK(BM_ValidateTable)->Arg(64)->Arg(4096);
+
+static void BM_ValidateTableProgram(benchmark::State& state) {
+  auto validator = makeTableValidator();
+  const auto& program = validator->program();
+  QJsonValue value(makeTable(int(state.range(0))));
+  for (auto _ : state)
+    benchmark::DoNotOptimize(program.run(value));
+  state.SetItemsProcessed(state.iterations() * state.range(0) * 16);
+}
+BENCHMARK(BM_ValidateTableProgram)->Arg(64)->Arg(4096);
+
+static void BM_CompileDeepTree(benchmark::State& state) {
+  auto validator = Validator::Abstract::deserializeFromJson(
+      makeDeepTree(int(state.range(0))));
+  for (auto _ : state)
+    benchmark::DoNotOptimize(Validator::ProgramBuilder::build(*validator));
+}
+BENCHMARK(BM_CompileDeepTree)->Arg(4)->Arg(16);
+
+static void BM_DeserializeDeepTree(benchmark::State& state) {
+  auto tree = makeDeepTree(int(state.range(0)));
+  for (auto _ : state)
+    benchmark::DoNotOptimize(Validator::Abstract::deserializeFromJson(tree));
+}
+BENCHMARK(BM_DeserializeDeepTree)->Arg(4)->Arg(16)->Arg(64);
+
+static void BM_SerializeDeepTree(benchmark::State& state) {
+  auto validator = Validator::Abstract::deserializeFromJson(
+      makeDeepTree(int(state.range(0))));
+  for (auto _ : state)
+    benchmark::DoNotOptimize(validator->serializeToJson());
+}
+BENCHMARK(BM_SerializeDeepTree)->Arg(4)->Arg(16);
+
+static void BM_SerializedPayloadUncached(benchmark::State& state) {
+  auto tree = makeDeepTree(int(state.range(0)));
+  for (auto _ : state) {
+    // A fresh validator every time, as after validatorChanged
+    state.PauseTiming();
+    auto validator = Validator::Abstract::deserializeFromJson(tree);
+    state.ResumeTiming();
+    benchmark::DoNotOptimize(validator->serializedPayload());
+  }
+}
+BENCHMARK(BM_SerializedPayloadUncached)->Arg(4)->Arg(16);
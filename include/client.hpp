@@ -2,13 +2,29 @@
 
 #include <qmqtt.h>
 #include <QByteArray>
+#include <QElapsedTimer>
+#include <QHash>
 #include <QHostAddress>
+#include <QMutex>
 #include <QObject>
 #include <QReadWriteLock>
-#include <map>
+#include <QSet>
+#include <QStringList>
+#include <QTimer>
+#include <QWaitCondition>
+#include <array>
+#include <atomic>
+#include <deque>
+#include <limits>
 #include <memory>
+#include <queue>
+#include <vector>
+#include "client_metrics.hpp"
 #include "global.hpp"
+#include "mpsc_queue.hpp"
 #include "named_value.hpp"
+#include "named_value_registry.hpp"
+#include "payload.hpp"
 
 #ifndef QT_NO_SSL
 #include <QSslConfiguration>
@@ -17,11 +33,28 @@
 #include <QWebSocketProtocol>
 #endif  // QT_WEBSOCKETS_LIB
 
+class QThreadPool;
+
 namespace SideAssist::Qt {
 
 class Q_SIDEASSIST_EXPORT Client : public QObject {
   Q_OBJECT
  public:
+  enum class SubscriptionMode {
+    // Subscribe option/{name}/set and option/{name} for every option
+    PerOption,
+    // Subscribe option/+/set and option/+ once, filter names locally
+    Wildcard,
+  };
+  enum class ConnectionState {
+    Disconnected,
+    Connecting,
+    Connected,
+    // Waiting for the next automatic reconnect attempt
+    Reconnecting,
+  };
+  Q_ENUM(ConnectionState)
+
   Client(const QHostAddress& host = QHostAddress::LocalHost,
          const quint16 port = 1883,
          QObject* parent = nullptr);
@@ -50,22 +83,144 @@ class Q_SIDEASSIST_EXPORT Client : public QObject {
          QObject* parent = nullptr);
 #endif  // QT_NO_SSL
 #endif  // QT_WEBSOCKETS_LIB
+  ~Client();
 
   void connectToHost();
+  // Stops automatic reconnects until the next connectToHost()
+  void disconnectFromHost();
+
+  ConnectionState connectionState() const { return connection_state_; }
+
+  // When the connection is refused or lost, reconnect after a delay that
+  // doubles per failed attempt from initial_msec up to max_msec, with
+  // up to half of it randomized. Registered options, parameters and
+  // validators are kept and uploaded again on reconnect. Enabled by
+  // default; when disabled, a refused connection is only logged.
+  void setAutoReconnect(bool enabled);
+  bool autoReconnect() const { return auto_reconnect_; }
+  void setReconnectBackoff(int initial_msec, int max_msec);
+  // Attempts since the last successful connection
+  int reconnectAttempts() const { return reconnect_attempts_; }
+  // Attempts over the lifetime of this client
+  quint64 totalReconnectAttempts() const { return total_reconnect_attempts_; }
+  // Opt-in: reconnects republish only values and validators changed since
+  // the broker last acknowledged them, assuming it still retains the rest.
+  // qmqtt does not report the CONNACK session-present flag, so a broker
+  // restarted without retained persistence (mosquitto's default) looks
+  // like a brief network loss and would not be restored. Only enable this
+  // for brokers that persist retained messages. By default every
+  // connection uploads everything.
+  void setIncrementalResync(bool enabled) { incremental_resync_ = enabled; }
+  bool incrementalResync() const { return incremental_resync_; }
 
   std::shared_ptr<NamedValue> addOption(
       const QString& name,
-      bool accept_remote_initial_value = true);
+      bool accept_remote_initial_value = true,
+      const DeliveryPolicy& policy = DeliveryPolicy());
   std::shared_ptr<NamedValue> option(
       const QString& name,
       bool create_if_not_found = false,
       bool accept_remote_initial_value_if_created = true);
-  std::shared_ptr<NamedValue> addParameter(const QString& name);
+  std::shared_ptr<NamedValue> addParameter(
+      const QString& name,
+      const DeliveryPolicy& policy = DeliveryPolicy());
   std::shared_ptr<NamedValue> parameter(const QString& name,
                                         bool create_if_not_found = false);
 
+  // Bulk versions of addOption/addParameter, returning values in the order
+  // of names. Registration happens under one lock and, in Wildcard
+  // subscription mode, costs at most one SUBSCRIBE.
+  std::vector<std::shared_ptr<NamedValue> > addOptions(
+      const QStringList& names,
+      bool accept_remote_initial_value = true,
+      const DeliveryPolicy& policy = DeliveryPolicy());
+  std::vector<std::shared_ptr<NamedValue> > addParameters(
+      const QStringList& names,
+      const DeliveryPolicy& policy = DeliveryPolicy());
+
   bool installDefaultMessageHandler();
 
+  // Opt-in persistent session (cleanSession=false). While disconnected,
+  // value and validator publishes are kept in a bounded queue holding only
+  // the latest message per topic. With incremental resync, a reconnect
+  // flushes that queue instead of uploading everything. If the queue
+  // overflowed, the reconnect falls back to a full upload. Subscriptions
+  // are still renewed on every connection, as a lost session cannot be
+  // told apart. Takes effect on the next connectToHost().
+  void setPersistentSession(bool persistent) {
+    persistent_session_ = persistent;
+  }
+  bool persistentSession() const { return persistent_session_; }
+  void setOfflineQueueCapacity(int capacity) {
+    offline_queue_capacity_ = capacity;
+  }
+  int offlineQueueSize() const { return offline_messages_.size(); }
+
+  // Received values are applied one event loop turn later, so that /set
+  // messages piling up for an option collapse into the newest one before
+  // they are parsed (see NamedValue::setCompactRemoteSets and
+  // ClientMetrics::compactedSets).
+  //
+  // Parse and validate received payloads on pool instead of the client's
+  // thread. Only setValue() is marshalled back, and messages for one option
+  // are applied in arrival order. nullptr, the default, handles messages
+  // on the client's thread. Set before connecting; the pool must outlive
+  // the client.
+  void setValidationThreadPool(QThreadPool* pool) { validation_pool_ = pool; }
+  QThreadPool* validationThreadPool() const { return validation_pool_; }
+
+  // Received payloads of a topic class above this many bytes are dropped
+  // before any parsing or formatting, and counted in
+  // ClientMetrics::oversizedPayloads(). This checks the size on the wire,
+  // a compressed payload is then inflated only until its output passes the
+  // same limit, or Payload::default_max_decompressed_size without one.
+  // Negative for no limit.
+  static constexpr qsizetype default_max_payload_size = 1024 * 1024;
+  void setMaxPayloadSize(ClientMetrics::TopicClass topic_class,
+                         qsizetype bytes) {
+    max_payload_sizes_[int(topic_class)] = bytes;
+  }
+  qsizetype maxPayloadSize(ClientMetrics::TopicClass topic_class) const {
+    return max_payload_sizes_[int(topic_class)];
+  }
+
+  // Safe to read from any thread
+  const ClientMetrics& metrics() const { return metrics_; }
+  // Publish metrics() as JSON to side_assist/{id}/metrics every interval
+  // (in ms), retained with QoS 0. 0 or negative stops publishing.
+  void setMetricsPublishInterval(int msec);
+  int metricsPublishInterval() const { return metrics_publish_interval_; }
+
+  // Thread-safe. Queues target->setValue(value) to be applied on the
+  // client's thread in batches, without waiting for the event loop. Returns
+  // false and drops the update when the queue is full.
+  bool submitValue(const std::shared_ptr<NamedValue>& target,
+                   const QJsonValue& value);
+
+  // Takes effect on the next connection
+  void setSubscriptionMode(SubscriptionMode mode);
+  SubscriptionMode subscriptionMode() const { return subscription_mode_; }
+
+  // Changed values are published at most once per interval (in ms), with
+  // the latest value. 0 flushes once per event loop turn, a negative
+  // interval publishes every change right away.
+  void setPublishCoalescingInterval(int msec);
+  int publishCoalescingInterval() const { return publish_coalescing_interval_; }
+
+  // Encoding of everything this client id publishes. It is announced as a
+  // retained side_assist/{id}/encoding message, so clients with different
+  // encodings can share a broker. Both encodings are accepted on receive.
+  void setPayloadEncoding(Payload::Encoding encoding);
+  Payload::Encoding payloadEncoding() const { return payload_encoding_; }
+
+  // Value and validator payloads of at least this many bytes are published
+  // compressed (see Payload::compress). Negative disables compression,
+  // which is the default as every subscriber must be able to decompress.
+  void setCompressionThreshold(qsizetype bytes) {
+    compression_threshold_ = bytes;
+  }
+  qsizetype compressionThreshold() const { return compression_threshold_; }
+
  public slots:
   void setClientId(const QString& clientId);
   void setUsername(const QString& username);
@@ -80,6 +235,8 @@ class Q_SIDEASSIST_EXPORT Client : public QObject {
  signals:
   void connected();
   void disconnected();
+  void connectionStateChanged(ConnectionState state);
+  void reconnectScheduled(int attempt, int delay_msec);
 
  private slots:
   void setupSubscriptions();
@@ -89,9 +246,19 @@ class Q_SIDEASSIST_EXPORT Client : public QObject {
   void uploadOptionValidator(const NamedValue* option);
   void uploadParameterValidator(const NamedValue* parameter);
   void uploadAll();
+  void uploadOnConnection();
+  void uploadPayloadEncoding();
+  void flushDirtyValues();
+  void flushThrottledValues();
+  void publishMetrics();
+  void applySubmittedValues();
+  void drainInboundQueues();
+  void handlePublished(const QMQTT::Message& message, quint16 id);
+  void dropPendingPublishes();
 
   void setupSubscriptionsForOption(const NamedValue* option,
                                    bool accept_remote_initial_value);
+  void setupWildcardSubscriptions();
 
   void logConnected();
   void logDisconnected();
@@ -100,16 +267,213 @@ class Q_SIDEASSIST_EXPORT Client : public QObject {
   void logUnsubscribed(const QString& topic);
   void handleMqttError(const QMQTT::ClientError error);
 
+  void handleConnected();
+  void handleDisconnected();
+  void scheduleReconnect();
+  void reconnect();
+
  private:
+  enum class ValueKind { Option, Parameter };
+  struct SubmittedValue {
+    std::shared_ptr<NamedValue> target;
+    QJsonValue value;
+  };
+  struct PendingPublish {
+    const NamedValue* value;
+    bool validator;
+    quint64 generation;  // Value publishes only
+    QByteArray digest;   // Validator publishes only
+  };
+  enum class TopicOperation {
+    RemoteSavedValue,  // side_assist/{id}/option/{name}
+    RemoteSet,         // side_assist/{id}/option/{name}/set
+  };
+  struct QueuedMessage {
+    QMQTT::Message message;
+    ClientMetrics::TopicClass topic_class;
+    PendingPublish publish;
+  };
+  struct ReceivedValue {
+    QByteArray payload;
+    QString topic;
+    bool remote_saved_value;
+    qsizetype max_decompressed_size;
+  };
+  // Received values of one option waiting to be applied. With a
+  // validation pool, the front message is in flight while in_flight is
+  // set. Without one, in_flight means the option awaits the next drain.
+  struct InboundQueue {
+    bool in_flight = false;
+    std::deque<ReceivedValue> messages;
+  };
+  struct TopicRoute {
+    NamedValue* value;
+    TopicOperation operation;
+  };
+
+  static constexpr std::array<qsizetype, ClientMetrics::topic_class_count>
+  defaultMaxPayloadSizes() {
+    std::array<qsizetype, ClientMetrics::topic_class_count> sizes{};
+    for (auto& size : sizes)
+      size = default_max_payload_size;
+    return sizes;
+  }
+  // Shared by the constructors
+  void initialize();
   void connectSignals();
+  std::shared_ptr<NamedValue> createOption(const QString& name,
+                                           const DeliveryPolicy& policy);
+  std::shared_ptr<NamedValue> createParameter(const QString& name,
+                                              const DeliveryPolicy& policy);
+
+  // These require options_lock_ to be held for writing
+  void rebuildDispatchTable();
+  void addDispatchRoutesForOption(NamedValue* option);
+  void awaitInitialValueOfOption(const NamedValue* option);
+  // Subscribes option/+ unless it is active already, in which case the
+  // retained values of added are taken from unrouted_initial_values_
+  void subscribeInitialValueFilter(
+      const std::vector<const NamedValue*>& added);
+  void claimUnroutedInitialValue(const NamedValue* option);
+  // Takes options_lock_ itself
+  void keepUnroutedInitialValue(const QMQTT::Message& message);
+  void markValueDirty(ValueKind kind, const NamedValue* value);
+  void throttleValue(ValueKind kind, const NamedValue* value);
+  void rescheduleThrottleTimer();
+  const QString& valueTopic(ValueKind kind, const NamedValue* value);
+  const QString& validatorTopic(ValueKind kind, const NamedValue* value);
+  void invalidateClientIdCaches();
+  // Makes the next connection upload every value and validator
+  void forgetPublishedValues();
+  QByteArray compressIfLarge(const QByteArray& payload) const;
+  bool acceptsPublishes() const;
+  // Sends and tracks publish, or queues both while offline
+  void publishMessage(const QMQTT::Message& message,
+                      ClientMetrics::TopicClass topic_class,
+                      const PendingPublish& publish);
+  quint16 sendMessage(const QMQTT::Message& message,
+                      ClientMetrics::TopicClass topic_class);
+  void enqueueOfflineMessage(const QMQTT::Message& message,
+                             ClientMetrics::TopicClass topic_class,
+                             const PendingPublish& publish);
+  // Returns the topics that were sent
+  QSet<QString> flushOfflineMessages();
+  // Changed since the broker last acknowledged it, kept across connections
+  void markValueUnsynced(ValueKind kind, const NamedValue* value);
+  bool isSynced(const NamedValue* value) const;
+  void trackPublish(quint16 id, quint8 qos, const PendingPublish& publish);
+  void acknowledgePublish(const PendingPublish& publish);
+  // Skips uploads to topics in sent_topics
+  void resyncUnsyncedValues(const QSet<QString>& sent_topics = {});
+  void setConnectionState(ConnectionState state);
+  // Thread-safe, called on validation_pool_ as well
+  bool readAndValidate(
+      const ReceivedValue& received,
+      const std::shared_ptr<ValueValidator::Abstract>& validator,
+      QJsonValue& value);
+  // display: the payload for the log line, formatted here if empty
+  void applyReceivedValue(NamedValue* option,
+                          const ReceivedValue& received,
+                          const QJsonValue& value,
+                          QString display = {});
+  void enqueueReceivedValue(NamedValue* option, ReceivedValue&& received);
+  void startValidation(NamedValue* option);
+  // validate_nsec: time spent in readAndValidate() on the pool
+  void finishValidation(NamedValue* option,
+                        bool valid,
+                        const QJsonValue& value,
+                        const QString& display,
+                        qint64 validate_nsec);
 
  private:
   std::unique_ptr<QMQTT::Client> mqtt_client_;
+  // Monotonic clock for throttling and metrics
+  QElapsedTimer clock_;
 
-  std::map<QString, std::shared_ptr<NamedValue> > options_;
+  NamedValueRegistry options_;
+  // Serializes addOption, guards the members below
   QReadWriteLock options_lock_;
-  std::map<QString, std::shared_ptr<NamedValue> > parameters_;
-  QReadWriteLock parameters_lock_;
+  // Full topic -> option & operation, guarded by options_lock_
+  QHash<QString, TopicRoute> dispatch_table_;
+  // "side_assist/{id}/", guarded by options_lock_
+  QString topic_prefix_;
+  // Wildcard mode only, guarded by options_lock_
+  QSet<const NamedValue*> options_awaiting_initial_value_;
+  bool initial_value_filter_subscribed_ = false;
+  // Retained values option/+ delivered for options not added yet, by
+  // topic. At most what the broker retains for this client id.
+  QHash<QString, QByteArray> unrouted_initial_values_;
+  NamedValueRegistry parameters_;
+
+  SubscriptionMode subscription_mode_ = SubscriptionMode::PerOption;
+  Payload::Encoding payload_encoding_ = Payload::Encoding::Json;
+  qsizetype compression_threshold_ = -1;
+
+  // Coalescing publish stage, only touched on the client's thread
+  int publish_coalescing_interval_ = 0;
+  QTimer publish_flush_timer_;
+  std::vector<std::pair<ValueKind, const NamedValue*> > dirty_values_;
+  QSet<const NamedValue*> dirty_value_set_;
+  // Rate limited values, only touched on the client's thread
+  struct Throttle {
+    ValueKind kind;
+    // ms on clock_, far enough back to publish the first change
+    qint64 last_publish = std::numeric_limits<qint32>::min();
+    bool pending = false;
+  };
+  using ThrottleDeadline = std::pair<qint64, const NamedValue*>;
+  QTimer throttle_timer_;
+  QHash<const NamedValue*, Throttle> throttles_;
+  std::priority_queue<ThrottleDeadline,
+                      std::vector<ThrottleDeadline>,
+                      std::greater<ThrottleDeadline> >
+      throttle_deadlines_;
+  // Reused for every value payload, only touched on the client's thread
+  QByteArray publish_buffer_;
+  // Persistent session, only touched on the client's thread
+  bool persistent_session_ = false;
+  bool uploaded_all_ = false;
+  bool incremental_resync_ = false;
+  int offline_queue_capacity_ = 10000;
+  bool offline_queue_overflowed_ = false;
+  QHash<QString, QueuedMessage> offline_messages_;
+  QStringList offline_topics_;
+
+  // Automatic reconnect, only touched on the client's thread
+  ConnectionState connection_state_ = ConnectionState::Disconnected;
+  bool auto_reconnect_ = true;
+  int reconnect_initial_delay_ = 500;
+  int reconnect_max_delay_ = 30000;
+  int reconnect_attempts_ = 0;
+  quint64 total_reconnect_attempts_ = 0;
+  QTimer reconnect_timer_;
+
+  // Filled by any thread through submitValue()
+  MpscQueue<SubmittedValue> submitted_values_{8192};
+  std::atomic<bool> submitted_values_scheduled_{false};
+
+  ClientMetrics metrics_;
+  std::array<qsizetype, ClientMetrics::topic_class_count> max_payload_sizes_ =
+      defaultMaxPayloadSizes();
+  int metrics_publish_interval_ = 0;
+  QTimer metrics_timer_;
+  QThreadPool* validation_pool_ = nullptr;
+  QHash<NamedValue*, InboundQueue> inbound_queues_;
+  // Options to drain, without a validation pool
+  std::vector<NamedValue*> inbound_pending_;
+  // Jobs that may still post back to this client, guarded by
+  // validations_mutex_
+  int validations_in_flight_ = 0;
+  QMutex validations_mutex_;
+  QWaitCondition validations_done_;
+
+  // Message id -> clock_ time in ns of the publish, QoS 1 and 2 only
+  QHash<quint16, qint64> publish_times_;
+
+  // Message id -> value or validator waiting for PUBACK/PUBCOMP
+  QHash<quint16, PendingPublish> pending_publishes_;
+  // Values whose value or validator the broker may not have yet
+  QHash<const NamedValue*, ValueKind> unsynced_values_;
 };
 
 }  // namespace SideAssist::Qt
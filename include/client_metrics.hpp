@@ -0,0 +1,146 @@
+#pragma once
+
+#include <QElapsedTimer>
+#include <QJsonObject>
+#include <array>
+#include <atomic>
+#include "global.hpp"
+
+namespace SideAssist::Qt {
+
+// Log2-bucketed histogram of durations in microseconds. Recording is
+// wait-free, so any thread may read while the client's thread records.
+class Q_SIDEASSIST_EXPORT LatencyHistogram {
+ public:
+  // Bucket i counts samples below 2^i us, the last one everything else
+  static constexpr int bucket_count = 32;
+
+  // Records the time from construction to destruction
+  class ScopedTimer {
+   public:
+    explicit ScopedTimer(LatencyHistogram& histogram)
+        : histogram_(histogram) {
+      timer_.start();
+    }
+    ~ScopedTimer() { histogram_.record(timer_.nsecsElapsed() / 1000); }
+
+   private:
+    LatencyHistogram& histogram_;
+    QElapsedTimer timer_;
+  };
+
+  void record(qint64 usec);
+  quint64 count() const { return count_.load(std::memory_order_relaxed); }
+  quint64 sum() const { return sum_.load(std::memory_order_relaxed); }
+  quint64 max() const { return max_.load(std::memory_order_relaxed); }
+  quint64 bucket(int i) const {
+    return buckets_[i].load(std::memory_order_relaxed);
+  }
+  // Upper bound of the bucket holding the p-th percentile, 0 <= p <= 1
+  quint64 percentile(double p) const;
+  void reset();
+
+  QJsonObject toJson() const;
+
+ private:
+  std::array<std::atomic<quint64>, bucket_count> buckets_{};
+  std::atomic<quint64> count_{0};
+  std::atomic<quint64> sum_{0};
+  std::atomic<quint64> max_{0};
+};
+
+class Q_SIDEASSIST_EXPORT ClientMetrics {
+ public:
+  enum class TopicClass {
+    OptionValue,         // option/{name}
+    OptionSet,           // option/{name}/set
+    OptionValidator,     // option/{name}/validator
+    ParameterValue,      // param/{name}
+    ParameterValidator,  // param/{name}/validator
+    Control,             // encoding, metrics
+    Unknown,
+  };
+  static constexpr int topic_class_count = int(TopicClass::Unknown) + 1;
+
+  quint64 received(TopicClass topic_class) const {
+    return received_[int(topic_class)].load(std::memory_order_relaxed);
+  }
+  quint64 published(TopicClass topic_class) const {
+    return published_[int(topic_class)].load(std::memory_order_relaxed);
+  }
+  quint64 bytesIn() const { return bytes_in_.load(std::memory_order_relaxed); }
+  quint64 bytesOut() const {
+    return bytes_out_.load(std::memory_order_relaxed);
+  }
+  quint64 parseFailures() const {
+    return parse_failures_.load(std::memory_order_relaxed);
+  }
+  quint64 validationFailures() const {
+    return validation_failures_.load(std::memory_order_relaxed);
+  }
+  // Received messages dropped by Client::setMaxPayloadSize()
+  quint64 oversizedPayloads(TopicClass topic_class) const {
+    return oversized_[int(topic_class)].load(std::memory_order_relaxed);
+  }
+  // /set messages replaced by a newer one for the same option before
+  // they were parsed
+  quint64 compactedSets() const {
+    return compacted_sets_.load(std::memory_order_relaxed);
+  }
+
+  // Time spent in Client::handleMessage, which routes a message and queues
+  // a received value
+  const LatencyHistogram& handleMessageTime() const {
+    return handle_message_time_;
+  }
+  // Time spent parsing, validating and applying a queued value, on the
+  // validation pool and the client's thread together
+  const LatencyHistogram& processReceivedTime() const {
+    return process_received_time_;
+  }
+  // From publish() to PUBACK/PUBCOMP, QoS 1 and 2 only
+  const LatencyHistogram& publishAckLatency() const {
+    return publish_ack_latency_;
+  }
+
+  void reset();
+  QJsonObject toJson() const;
+
+ private:
+  friend class Client;
+
+  void countReceived(TopicClass topic_class, qsizetype bytes) {
+    received_[int(topic_class)].fetch_add(1, std::memory_order_relaxed);
+    bytes_in_.fetch_add(quint64(bytes), std::memory_order_relaxed);
+  }
+  void countPublished(TopicClass topic_class, qsizetype bytes) {
+    published_[int(topic_class)].fetch_add(1, std::memory_order_relaxed);
+    bytes_out_.fetch_add(quint64(bytes), std::memory_order_relaxed);
+  }
+  void countParseFailure() {
+    parse_failures_.fetch_add(1, std::memory_order_relaxed);
+  }
+  void countValidationFailure() {
+    validation_failures_.fetch_add(1, std::memory_order_relaxed);
+  }
+  void countOversizedPayload(TopicClass topic_class) {
+    oversized_[int(topic_class)].fetch_add(1, std::memory_order_relaxed);
+  }
+  void countCompactedSet() {
+    compacted_sets_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  std::array<std::atomic<quint64>, topic_class_count> received_{};
+  std::array<std::atomic<quint64>, topic_class_count> published_{};
+  std::array<std::atomic<quint64>, topic_class_count> oversized_{};
+  std::atomic<quint64> bytes_in_{0};
+  std::atomic<quint64> bytes_out_{0};
+  std::atomic<quint64> parse_failures_{0};
+  std::atomic<quint64> validation_failures_{0};
+  std::atomic<quint64> compacted_sets_{0};
+  LatencyHistogram handle_message_time_;
+  LatencyHistogram process_received_time_;
+  LatencyHistogram publish_ack_latency_;
+};
+
+}  // namespace SideAssist::Qt
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace SideAssist::Qt {
+
+// Bounded multi-producer single-consumer queue after D. Vyukov's bounded
+// MPMC queue. Producers never block: tryPush() fails when the queue is full.
+// Only one thread at a time may call tryPop().
+template <typename T>
+class MpscQueue {
+ public:
+  // capacity is rounded up to a power of two
+  explicit MpscQueue(size_t capacity)
+      : mask_(roundUpToPowerOfTwo(capacity) - 1),
+        cells_(std::make_unique<Cell[]>(mask_ + 1)) {
+    for (size_t i = 0; i <= mask_; ++i)
+      cells_[i].sequence.store(i, std::memory_order_relaxed);
+  }
+  MpscQueue(const MpscQueue&) = delete;
+  MpscQueue& operator=(const MpscQueue&) = delete;
+
+  size_t capacity() const { return mask_ + 1; }
+
+  bool tryPush(T value) {
+    Cell* cell;
+    size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+    for (;;) {
+      cell = &cells_[pos & mask_];
+      size_t seq = cell->sequence.load(std::memory_order_acquire);
+      auto diff = intptr_t(seq) - intptr_t(pos);
+      if (diff == 0) {
+        if (enqueue_pos_.compare_exchange_weak(pos, pos + 1,
+                                               std::memory_order_relaxed))
+          break;
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = enqueue_pos_.load(std::memory_order_relaxed);
+      }
+    }
+    cell->value = std::move(value);
+    cell->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  bool tryPop(T& value) {
+    Cell* cell = &cells_[dequeue_pos_ & mask_];
+    size_t seq = cell->sequence.load(std::memory_order_acquire);
+    if (intptr_t(seq) - intptr_t(dequeue_pos_ + 1) < 0)
+      return false;
+    value = std::move(cell->value);
+    // Release the slot's resources before handing it back to producers
+    cell->value = T();
+    cell->sequence.store(dequeue_pos_ + mask_ + 1, std::memory_order_release);
+    ++dequeue_pos_;
+    return true;
+  }
+
+ private:
+  struct Cell {
+    std::atomic<size_t> sequence;
+    T value;
+  };
+
+  static size_t roundUpToPowerOfTwo(size_t n) {
+    size_t p = 2;
+    while (p < n)
+      p <<= 1;
+    return p;
+  }
+
+  const size_t mask_;
+  const std::unique_ptr<Cell[]> cells_;
+  alignas(64) std::atomic<size_t> enqueue_pos_{0};
+  alignas(64) size_t dequeue_pos_ = 0;
+};
+
+}  // namespace SideAssist::Qt
@@ -3,7 +3,7 @@
 
 namespace SideAssist::Qt {
 bool NamedValue::validate(const QJsonValue& val) {
-  return validator_ == nullptr ? true : validator_->validate(val);
+  return validator_ == nullptr ? true : validator_->program().run(val);
 }
 
 }  // namespace SideAssist::Qt
@@ -2,6 +2,7 @@
 #include <QJsonValue>
 #include <QObject>
 #include "global.hpp"
+#include "tracer.hpp"
 
 namespace SideAssist::Qt {
 
@@ -9,6 +10,12 @@ namespace ValueValidator {
 class Abstract;
 }  // namespace ValueValidator
 
+// How the client publishes a value
+struct DeliveryPolicy {
+  quint8 qos = 2;
+  bool retain = true;
+};
+
 class Q_SIDEASSIST_EXPORT NamedValue : public QObject {
   Q_OBJECT
   Q_PROPERTY(QString name READ name MEMBER name_ CONSTANT)
@@ -24,6 +31,31 @@ class Q_SIDEASSIST_EXPORT NamedValue : public QObject {
 
   bool validate(const QJsonValue& val);
 
+  // Whether the client may merge a burst of changes into a single publish
+  // of the latest value. Turn off when every sample matters.
+  bool coalescing() const { return coalescing_; }
+  void setCoalescing(bool coalescing) { coalescing_ = coalescing; }
+
+  // Whether the client may drop a received /set for this option when a
+  // newer one arrives before it was parsed. Only the newest remote change
+  // is applied then. Turn off when every remote change matters.
+  bool compactsRemoteSets() const { return compact_remote_sets_; }
+  void setCompactRemoteSets(bool compact) { compact_remote_sets_ = compact; }
+
+  // Publishes per second the client makes of this value at most, 0 for
+  // no limit. Changes in between are merged, and the latest value is
+  // always published once the interval has passed.
+  double maxPublishRate() const { return max_publish_rate_; }
+  void setMaxPublishRate(double per_second) {
+    max_publish_rate_ = per_second > 0 ? per_second : 0;
+  }
+
+  const DeliveryPolicy& deliveryPolicy() const { return delivery_policy_; }
+  void setDeliveryPolicy(const DeliveryPolicy& policy) {
+    Q_ASSERT(policy.qos <= 2);
+    delivery_policy_ = policy;
+  }
+
   NamedValue(const QString& name, const QJsonValue& value)
       : name_(name), value_(value) {}
   NamedValue(QString&& name, QJsonValue&& value) : name_(name), value_(value) {}
@@ -33,9 +65,12 @@ class Q_SIDEASSIST_EXPORT NamedValue : public QObject {
 
  public slots:
   void setValue(const QJsonValue& value) {
+    SIDE_ASSIST_TRACE_SCOPE("setValue");
     if (value == value_)
       return;
     value_ = value;
+    ++generation_;
+    SIDE_ASSIST_TRACE_SCOPE("slot fan-out");
     emit valueChanged(value_);
   }
   void setValidator(std::shared_ptr<ValueValidator::Abstract> validator) {
@@ -51,9 +86,25 @@ class Q_SIDEASSIST_EXPORT NamedValue : public QObject {
       const std::shared_ptr<ValueValidator::Abstract>& validator);
 
  private:
+  friend class Client;
+
   const QString name_;
   QJsonValue value_;
   std::shared_ptr<ValueValidator::Abstract> validator_;
+  bool coalescing_ = true;
+  bool compact_remote_sets_ = true;
+  double max_publish_rate_ = 0;
+  DeliveryPolicy delivery_policy_;
+  // Bumped by every change of value_
+  quint64 generation_ = 0;
+
+  // Topics cached by the owning client, cleared when its id changes
+  mutable QString value_topic_;
+  mutable QString validator_topic_;
+  // Digest of the validator and generation of the value the broker
+  // acknowledged last under this id
+  mutable QByteArray published_validator_digest_;
+  mutable quint64 published_generation_ = 0;
 };
 
 }  // namespace SideAssist::Qt
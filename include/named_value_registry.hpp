@@ -0,0 +1,70 @@
+#pragma once
+
+#include <QMutex>
+#include <QString>
+#include <atomic>
+#include <memory>
+#include <utility>
+#include <vector>
+#include "global.hpp"
+#include "named_value.hpp"
+
+namespace SideAssist::Qt {
+
+// Name -> NamedValue map for read-mostly access from many threads.
+// Lookups are wait-free: they probe an open addressing table published
+// through an atomic pointer, and never touch a shared lock.
+// Inserts are serialized by a mutex and copy the table when it is half full.
+// Entries are never removed, so outgrown tables are simply kept until
+// destruction, which costs at most as much memory as the current table.
+class Q_SIDEASSIST_EXPORT NamedValueRegistry {
+ public:
+  NamedValueRegistry();
+  ~NamedValueRegistry();
+  NamedValueRegistry(const NamedValueRegistry&) = delete;
+  NamedValueRegistry& operator=(const NamedValueRegistry&) = delete;
+
+  // Wait-free. The returned pointer stays valid as long as the registry.
+  const std::shared_ptr<NamedValue>* find(const QString& name) const;
+
+  // Inserts value unless name is taken. Returns the registered value and
+  // whether it was inserted.
+  std::pair<const std::shared_ptr<NamedValue>*, bool> emplace(
+      const QString& name,
+      std::shared_ptr<NamedValue> value);
+
+  // Same as emplace() for every item, under a single lock
+  std::vector<std::pair<const std::shared_ptr<NamedValue>*, bool> > emplace(
+      std::vector<std::pair<QString, std::shared_ptr<NamedValue> > > items);
+
+  // Snapshot in insertion order
+  std::vector<std::shared_ptr<NamedValue> > values() const;
+  size_t size() const;
+
+ private:
+  struct Entry {
+    QString name;
+    size_t hash;
+    std::shared_ptr<NamedValue> value;
+  };
+  struct Table {
+    explicit Table(size_t capacity);
+    size_t mask;
+    std::unique_ptr<std::atomic<const Entry*>[]> slots;
+  };
+
+  static void insertInto(Table& table, const Entry* entry);
+  // Both require write_mutex_
+  void reserveLocked(size_t count);
+  std::pair<const std::shared_ptr<NamedValue>*, bool> emplaceLocked(
+      const QString& name,
+      std::shared_ptr<NamedValue> value);
+
+  std::atomic<const Table*> table_;
+  mutable QMutex write_mutex_;
+  // Guarded by write_mutex_, the last table is the current one
+  std::vector<std::unique_ptr<Table> > tables_;
+  std::vector<std::unique_ptr<Entry> > entries_;
+};
+
+}  // namespace SideAssist::Qt
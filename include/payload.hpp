@@ -0,0 +1,64 @@
+#pragma once
+
+#include <QByteArray>
+#include <QJsonValue>
+#include "global.hpp"
+
+namespace SideAssist::Qt::Payload {
+
+enum class Encoding {
+  Json,
+  // Tagged with the CBOR self-describe tag (0xd9d9f7) so both encodings can
+  // be told apart by their first bytes
+  Cbor,
+};
+
+// Replaces the content of buf with {"value":<value>}.
+// In JSON, scalars are written straight into buf, which keeps its
+// allocation when it is not shared, so a steady-state publish of a number
+// or bool does not allocate. Arrays and objects go through QJsonDocument.
+Q_SIDEASSIST_EXPORT void writeValue(const QJsonValue& value,
+                                    QByteArray& buf,
+                                    Encoding encoding = Encoding::Json);
+
+// Wraps a serialized validator as {"validator":<validator>}
+Q_SIDEASSIST_EXPORT QByteArray writeValidator(const QJsonValue& validator,
+                                              Encoding encoding);
+
+Q_SIDEASSIST_EXPORT Encoding detectEncoding(const QByteArray& payload);
+
+// Default bound for decompress() and readValue()
+constexpr qsizetype default_max_decompressed_size = 16 * 1024 * 1024;
+
+// Compressed payloads are "\0SAZ" followed by qCompress() output, which
+// neither a JSON nor a tagged CBOR payload can start with
+Q_SIDEASSIST_EXPORT bool isCompressed(const QByteArray& payload);
+Q_SIDEASSIST_EXPORT QByteArray compress(const QByteArray& payload);
+// Fails if the output would exceed max_size, whatever size the header
+// announces
+Q_SIDEASSIST_EXPORT bool decompress(const QByteArray& payload,
+                                    QByteArray& out,
+                                    qsizetype max_size,
+                                    QString* error = nullptr);
+
+// Reads {"value":...} in either encoding, compressed or not. Returns false
+// with error set on a malformed payload. value is Undefined when there is
+// no "value" member.
+Q_SIDEASSIST_EXPORT bool readValue(
+    const QByteArray& payload,
+    QJsonValue& value,
+    QString* error = nullptr,
+    qsizetype max_decompressed_size = default_max_decompressed_size);
+
+// Parses a JSON {"value":<number|bool|string|null>} without building a
+// document. Returns false for anything else (arrays, objects, more members,
+// non-ASCII or \u escaped strings, malformed JSON), which readValue() then
+// hands to QJsonDocument. Yields the same value as QJsonDocument otherwise.
+Q_SIDEASSIST_EXPORT bool readScalarValue(const QByteArray& payload,
+                                         QJsonValue& value);
+
+// Human readable form of a payload for log lines. Looks at no more than
+// the first KiB and never inflates a compressed payload.
+Q_SIDEASSIST_EXPORT QString toDisplayString(const QByteArray& payload);
+
+}  // namespace SideAssist::Qt::Payload
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <QByteArray>
+#include <QString>
+#include <atomic>
+#include <cstddef>
+#include "global.hpp"
+
+namespace SideAssist::Qt {
+
+// Opt-in recorder of timed spans, written out in the Chrome trace-event
+// format (load in Perfetto or chrome://tracing). Every thread appends to
+// its own fixed-capacity buffer without locks; once a buffer is full its
+// further spans are dropped. While disabled a span costs one relaxed load.
+class Q_SIDEASSIST_EXPORT Tracer {
+ public:
+  // Records the time from construction to destruction. name must outlive
+  // the tracer, in practice a string literal.
+  class Span {
+   public:
+    explicit Span(const char* name)
+        : name_(name), begin_(enabled() ? now() : -1) {}
+    ~Span() {
+      if (begin_ >= 0)
+        record(name_, begin_, now());
+    }
+    Span(const Span&) = delete;
+    Span& operator=(const Span&) = delete;
+
+   private:
+    const char* name_;
+    qint64 begin_;
+  };
+
+  static bool enabled() { return enabled_.load(std::memory_order_relaxed); }
+  static void setEnabled(bool enabled);
+  // Events per thread buffer, applies to threads that record their first
+  // span afterwards. Defaults to 65536.
+  static void setBufferCapacity(size_t events);
+
+  // Nanoseconds on a monotonic clock
+  static qint64 now();
+  static void record(const char* name, qint64 begin_ns, qint64 end_ns);
+
+  // Spans recorded so far, as a complete trace-event JSON document.
+  // Meant to be called once recording threads are idle: spans recorded
+  // concurrently may or may not be included.
+  static QByteArray toChromeTraceJson();
+  static bool writeChromeTrace(const QString& path);
+  // Spans dropped because a thread buffer was full
+  static quint64 droppedEvents();
+  // Forgets all spans. No thread may be recording.
+  static void clear();
+
+ private:
+  static std::atomic<bool> enabled_;
+};
+
+}  // namespace SideAssist::Qt
+
+#define SIDE_ASSIST_TRACE_CONCAT_(a, b) a##b
+#define SIDE_ASSIST_TRACE_CONCAT(a, b) SIDE_ASSIST_TRACE_CONCAT_(a, b)
+// Traces the rest of the enclosing scope as a span called name
+#define SIDE_ASSIST_TRACE_SCOPE(name)                    \
+  ::SideAssist::Qt::Tracer::Span SIDE_ASSIST_TRACE_CONCAT( \
+      side_assist_trace_span_, __LINE__)(name)
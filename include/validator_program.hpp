@@ -0,0 +1,96 @@
+#pragma once
+
+#include <QJsonArray>
+#include <QJsonValue>
+#include <QtGlobal>
+#include <set>
+#include <vector>
+#include "global.hpp"
+
+namespace SideAssist::Qt::ValueValidator {
+
+class Abstract;
+class AbstractArray;
+
+// A validator tree lowered into one flat instruction array. Instructions
+// set a single result flag, Any and All become conditional jumps past the
+// remaining branches and type checks become one bit mask test. Validators
+// without a lowering are called through validate().
+//
+// A program points into the tree it was compiled from and is only handed
+// out by Abstract::program(), which keeps both alive together.
+class Q_SIDEASSIST_EXPORT Program {
+ public:
+  enum class Opcode : quint8 {
+    Accept,
+    Reject,
+    // operand: ValueTypeField mask, Double values carry the Integer bit too
+    // when they hold an integer
+    TypeMask,
+    // operand: index of the string set
+    Option,
+    Prefix,
+    Suffix,
+    // operand: index of the validator
+    Call,
+    // operand: target instruction
+    JumpIfFalse,
+    JumpIfTrue,
+    // Runs the following instructions up to their Return on every item,
+    // operand: instruction after that Return
+    EachItem,
+    Return,
+  };
+
+  struct Instruction {
+    Opcode op;
+    quint32 operand;
+  };
+
+  bool run(const QJsonValue& value) const noexcept { return run(value, 0); }
+
+  const std::vector<Instruction>& instructions() const { return code_; }
+
+ private:
+  friend class ProgramBuilder;
+
+  bool run(const QJsonValue& value, quint32 pc) const noexcept;
+  bool runEachItem(const QJsonArray& array, quint32 pc) const noexcept;
+
+  std::vector<Instruction> code_;
+  std::vector<const std::set<QString>*> string_sets_;
+  std::vector<const Abstract*> calls_;
+};
+
+// Validators lower themselves through Abstract::compile(), which calls
+// back into the emit functions here
+class Q_SIDEASSIST_EXPORT ProgramBuilder {
+ public:
+  static Program build(const Abstract& root);
+
+  void compile(const Abstract& validator);
+
+  void emitAccept();
+  void emitReject();
+  void emitTypeMask(quint32 mask);
+  void emitOption(const std::set<QString>& options);
+  void emitPrefix(const std::set<QString>& prefixes);
+  void emitSuffix(const std::set<QString>& suffixes);
+  void emitCall(const Abstract& validator);
+  void emitAny(const AbstractArray& validators);
+  void emitAll(const AbstractArray& validators);
+  void emitEachItem(const Abstract& item_validator);
+
+ private:
+  using Opcode = Program::Opcode;
+
+  quint32 pc() const { return quint32(program_.code_.size()); }
+  void emit(Opcode op, quint32 operand = 0);
+  void emitBranches(const AbstractArray& validators,
+                    Opcode jump,
+                    Opcode empty);
+
+  Program program_;
+};
+
+}  // namespace SideAssist::Qt::ValueValidator
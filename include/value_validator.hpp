@@ -1,10 +1,14 @@
 #pragma once
 
+#include <QByteArray>
 #include <QJsonValue>
+#include <atomic>
 #include <list>
 #include <set>
 #include "field_enum.hpp"
 #include "global.hpp"
+#include "payload.hpp"
+#include "validator_program.hpp"
 
 namespace SideAssist::Qt::ValueValidator {
 
@@ -16,15 +20,38 @@ class Q_SIDEASSIST_EXPORT Abstract {
   virtual QJsonValue serializeToJson() const noexcept = 0;
   static std::shared_ptr<Abstract> deserializeFromJson(
       const QJsonValue& validator);
+
+  // {"validator":...} payload and the SHA-1 of its JSON form, computed on
+  // first use. A validator must not be modified after either has been read.
+  const QByteArray& serializedPayload(
+      Payload::Encoding encoding = Payload::Encoding::Json) const;
+  const QByteArray& digest() const;
+
+  // This validator compiled into a flat program, built on first use under
+  // the same rule as serializedPayload()
+  const Program& program() const;
+  // Emits the instructions of this validator, the default calls validate()
+  virtual void compile(ProgramBuilder& builder) const;
+
   constexpr explicit Abstract() noexcept {}
-  constexpr Abstract(const Abstract&) noexcept = default;
-  constexpr Abstract(Abstract&&) noexcept = default;
+  // The cache belongs to the instance and is never copied
+  constexpr Abstract(const Abstract&) noexcept {}
+  constexpr Abstract(Abstract&&) noexcept {}
+  virtual ~Abstract();
+
+ private:
+  struct SerializedCache;
+  const SerializedCache& serializedCache() const;
+
+  mutable std::atomic<SerializedCache*> serialized_cache_{nullptr};
+  mutable std::atomic<Program*> program_{nullptr};
 };
 
 class Q_SIDEASSIST_EXPORT Dummy : public Abstract {
  public:
   virtual bool validate(const QJsonValue& value) const noexcept final;
   virtual QJsonValue serializeToJson() const noexcept final;
+  virtual void compile(ProgramBuilder& builder) const final;
 
   Dummy() = default;
   Dummy(const Dummy&) = default;
@@ -50,6 +77,7 @@ class Q_SIDEASSIST_EXPORT SingleType : public Abstract {
  public:
   virtual bool validate(const QJsonValue& value) const noexcept final;
   virtual QJsonValue serializeToJson() const noexcept final;
+  virtual void compile(ProgramBuilder& builder) const final;
   static std::shared_ptr<SingleType> deserializeFromJson(
       const QJsonValue& validator,
       bool* is_this_type);
@@ -93,6 +121,7 @@ class Q_SIDEASSIST_EXPORT Types : public Abstract {
  public:
   virtual bool validate(const QJsonValue& value) const noexcept final;
   virtual QJsonValue serializeToJson() const noexcept final;
+  virtual void compile(ProgramBuilder& builder) const final;
   static std::shared_ptr<Types> deserializeFromJson(const QJsonValue& validator,
                                                     bool* is_this_type);
 
@@ -210,6 +239,7 @@ class Q_SIDEASSIST_EXPORT Option : public Abstract {
  public:
   virtual bool validate(const QJsonValue& value) const noexcept final;
   virtual QJsonValue serializeToJson() const noexcept final;
+  virtual void compile(ProgramBuilder& builder) const final;
 
   Option(const std::set<QString>& options) : options_(options) {}
   Option(std::set<QString>&& options) : options_(options) {}
@@ -227,6 +257,7 @@ class Q_SIDEASSIST_EXPORT StringPrefix : public Abstract {
  public:
   virtual bool validate(const QJsonValue& value) const noexcept final;
   virtual QJsonValue serializeToJson() const noexcept final;
+  virtual void compile(ProgramBuilder& builder) const final;
 
   StringPrefix(const std::set<QString>& prefix) : prefixes_(prefix) {}
   StringPrefix(std::set<QString>&& prefix) : prefixes_(prefix) {}
@@ -244,6 +275,7 @@ class Q_SIDEASSIST_EXPORT StringSuffix : public Abstract {
  public:
   virtual bool validate(const QJsonValue& value) const noexcept final;
   virtual QJsonValue serializeToJson() const noexcept final;
+  virtual void compile(ProgramBuilder& builder) const final;
 
   StringSuffix(const std::set<QString>& suffix) : suffixes_(suffix) {}
   StringSuffix(std::set<QString>&& suffix) : suffixes_(suffix) {}
@@ -280,6 +312,7 @@ class Q_SIDEASSIST_EXPORT Any : public AbstractArray {
  public:
   virtual bool validate(const QJsonValue& value) const noexcept final;
   virtual QJsonValue serializeToJson() const noexcept final;
+  virtual void compile(ProgramBuilder& builder) const final;
 
   using AbstractArray::AbstractArray;
 
@@ -291,6 +324,7 @@ class Q_SIDEASSIST_EXPORT All : public AbstractArray {
  public:
   virtual bool validate(const QJsonValue& value) const noexcept final;
   virtual QJsonValue serializeToJson() const noexcept final;
+  virtual void compile(ProgramBuilder& builder) const final;
 
   using AbstractArray::AbstractArray;
 
@@ -302,6 +336,7 @@ class Q_SIDEASSIST_EXPORT ListItem : public Abstract {
  public:
   virtual bool validate(const QJsonValue& value) const noexcept final;
   virtual QJsonValue serializeToJson() const noexcept final;
+  virtual void compile(ProgramBuilder& builder) const final;
 
   ListItem(const std::shared_ptr<Abstract>& item_validator)
       : item_validator_(item_validator) {}
@@ -1,12 +1,13 @@
 #include "client.hpp"
-#include <QReadLocker>
+#include <QMutexLocker>
 #include <QWriteLocker>
+#include "value_validator.hpp"
 
 namespace SideAssist::Qt {
 
 Client::Client(const QHostAddress& host, const quint16 port, QObject* parent)
     : mqtt_client_(std::make_unique<QMQTT::Client>(host, port, parent)) {
-  connectSignals();
+  initialize();
 }
 
 Client::Client(const QString& hostName,
@@ -19,7 +20,7 @@ Client::Client(const QString& hostName,
                                                    config,
                                                    ignoreSelfSigned,
                                                    parent)) {
-  connectSignals();
+  initialize();
 }
 
 Client::Client(const QString& url,
@@ -32,7 +33,7 @@ Client::Client(const QString& url,
                                                    version,
                                                    ignoreSelfSigned,
                                                    parent)) {
-  connectSignals();
+  initialize();
 }
 
 Client::Client(const QString& url,
@@ -47,10 +48,34 @@ Client::Client(const QString& url,
                                                    config,
                                                    ignoreSelfSigned,
                                                    parent)) {
+  initialize();
+}
+
+Client::~Client() {
+  // Jobs on validation_pool_ post back to this client when done
+  QMutexLocker lock(&validations_mutex_);
+  while (validations_in_flight_ > 0)
+    validations_done_.wait(&validations_mutex_);
+}
+
+void Client::initialize() {
+  {
+    QWriteLocker lock(&options_lock_);
+    rebuildDispatchTable();
+  }
+  clock_.start();
+  publish_flush_timer_.setSingleShot(true);
+  throttle_timer_.setSingleShot(true);
+  reconnect_timer_.setSingleShot(true);
   connectSignals();
 }
 
 void Client::connectSignals() {
+  connect(&publish_flush_timer_, &QTimer::timeout, this,
+          &Client::flushDirtyValues);
+  connect(&throttle_timer_, &QTimer::timeout, this,
+          &Client::flushThrottledValues);
+
   connect(mqtt_client_.get(), &QMQTT::Client::connected, this,
           &Client::connected);
   connect(this, &Client::connected, this, &Client::logConnected);
@@ -64,24 +89,48 @@ void Client::connectSignals() {
           &Client::logUnsubscribed);
   connect(mqtt_client_.get(), &QMQTT::Client::published, this,
           &Client::logPublished);
+  connect(mqtt_client_.get(), &QMQTT::Client::published, this,
+          &Client::handlePublished);
+  connect(this, &Client::disconnected, this, &Client::dropPendingPublishes);
 
   connect(mqtt_client_.get(), &QMQTT::Client::error, this,
           &Client::handleMqttError);
 
+  connect(&reconnect_timer_, &QTimer::timeout, this, &Client::reconnect);
+  connect(&metrics_timer_, &QTimer::timeout, this, &Client::publishMetrics);
+  connect(mqtt_client_.get(), &QMQTT::Client::connected, this,
+          &Client::handleConnected);
+  connect(mqtt_client_.get(), &QMQTT::Client::disconnected, this,
+          &Client::handleDisconnected);
+
   connect(mqtt_client_.get(), &QMQTT::Client::connected, this,
           &Client::setupSubscriptions);
-  connect(this, &Client::connected, this, &Client::uploadAll);
+  connect(this, &Client::connected, this, &Client::uploadPayloadEncoding);
+  connect(this, &Client::connected, this, &Client::uploadOnConnection);
   connect(mqtt_client_.get(), &QMQTT::Client::received, this,
           &Client::handleMessage);
 }
 
 void Client::connectToHost() {
-  mqtt_client_->setCleanSession(true);
+  reconnect_timer_.stop();
+  setConnectionState(ConnectionState::Connecting);
+  mqtt_client_->setCleanSession(!persistent_session_);
   mqtt_client_->connectToHost();
 }
 
+void Client::disconnectFromHost() {
+  reconnect_timer_.stop();
+  setConnectionState(ConnectionState::Disconnected);
+  mqtt_client_->disconnectFromHost();
+}
+
 void Client::setClientId(const QString& clientId) {
   mqtt_client_->setClientId(clientId);
+  {
+    QWriteLocker lock(&options_lock_);
+    rebuildDispatchTable();
+  }
+  invalidateClientIdCaches();
 }
 
 void Client::setUsername(const QString& username) {
@@ -92,35 +141,61 @@ void Client::setPassword(const QByteArray& password) {
   mqtt_client_->setPassword(password);
 }
 
+void Client::setSubscriptionMode(SubscriptionMode mode) {
+  subscription_mode_ = mode;
+}
+
 void Client::setupSubscriptions() {
-  {
-    QReadLocker lock(&options_lock_);
-    for (auto& itr : options_) {
-      setupSubscriptionsForOption(itr.second.get(), itr.second->value().isUndefined());
-    }
+  // Also on a resumed persistent session: qmqtt does not report the CONNACK
+  // session-present flag, so a session the broker expired or lost looks
+  // the same. Resubscribing is idempotent and redelivers retained initial
+  // values.
+  if (subscription_mode_ == SubscriptionMode::Wildcard) {
+    setupWildcardSubscriptions();
+    return;
+  }
+  for (auto& option : options_.values())
+    setupSubscriptionsForOption(option.get(), option->value().isUndefined());
+}
+
+void Client::uploadOnConnection() {
+  if (!incremental_resync_ && uploaded_all_)
+    forgetPublishedValues();
+  if (persistent_session_ && uploaded_all_ && !offline_queue_overflowed_) {
+    // Publishes in flight at the disconnect were dropped unacknowledged,
+    // and are not in the queue
+    resyncUnsyncedValues(flushOfflineMessages());
+    return;
   }
+  // Everything queued is superseded by the full upload
+  offline_messages_.clear();
+  offline_topics_.clear();
+  offline_queue_overflowed_ = false;
+  // Only what changed since the broker last acknowledged it
+  if (uploaded_all_)
+    resyncUnsyncedValues();
+  else
+    uploadAll();
+  uploaded_all_ = true;
 }
 
 void Client::uploadAll() {
-  {
-    QReadLocker lock(&options_lock_);
-    for (auto& itr : options_) {
-      auto& ptr = itr.second;
-      if (ptr->value().type() != QJsonValue::Undefined)
-        uploadOptionValue(ptr.get());
-      if (ptr->validator())
-        uploadOptionValidator(ptr.get());
-    }
+  for (auto& ptr : options_.values()) {
+    if (ptr->value().type() != QJsonValue::Undefined &&
+        ptr->generation_ != ptr->published_generation_)
+      uploadOptionValue(ptr.get());
+    // Skip validators the broker already retains
+    if (ptr->validator() &&
+        ptr->validator()->digest() != ptr->published_validator_digest_)
+      uploadOptionValidator(ptr.get());
   }
-  {
-    QReadLocker lock(&parameters_lock_);
-    for (auto& itr : parameters_) {
-      auto& ptr = itr.second;
-      if (ptr->value().type() != QJsonValue::Undefined)
-        uploadParameterValue(ptr.get());
-      if (ptr->validator())
-        uploadParameterValidator(ptr.get());
-    }
+  for (auto& ptr : parameters_.values()) {
+    if (ptr->value().type() != QJsonValue::Undefined &&
+        ptr->generation_ != ptr->published_generation_)
+      uploadParameterValue(ptr.get());
+    if (ptr->validator() &&
+        ptr->validator()->digest() != ptr->published_validator_digest_)
+      uploadParameterValidator(ptr.get());
   }
 }
 
@@ -0,0 +1,72 @@
+#include <QRandomGenerator>
+#include <algorithm>
+#include "client.hpp"
+
+namespace SideAssist::Qt {
+
+void Client::setAutoReconnect(bool enabled) {
+  auto_reconnect_ = enabled;
+  if (!enabled && reconnect_timer_.isActive()) {
+    reconnect_timer_.stop();
+    setConnectionState(ConnectionState::Disconnected);
+  }
+}
+
+void Client::setReconnectBackoff(int initial_msec, int max_msec) {
+  Q_ASSERT(initial_msec > 0 && max_msec >= initial_msec);
+  reconnect_initial_delay_ = initial_msec;
+  reconnect_max_delay_ = max_msec;
+}
+
+void Client::setConnectionState(ConnectionState state) {
+  if (connection_state_ == state)
+    return;
+  connection_state_ = state;
+  emit connectionStateChanged(state);
+}
+
+void Client::handleConnected() {
+  reconnect_timer_.stop();
+  reconnect_attempts_ = 0;
+  setConnectionState(ConnectionState::Connected);
+}
+
+void Client::handleDisconnected() {
+  // disconnectFromHost() already moved to Disconnected
+  if (connection_state_ == ConnectionState::Disconnected)
+    return;
+  scheduleReconnect();
+}
+
+void Client::scheduleReconnect() {
+  if (!auto_reconnect_) {
+    setConnectionState(ConnectionState::Disconnected);
+    return;
+  }
+  // Both error() and disconnected() may report the same failure
+  if (reconnect_timer_.isActive())
+    return;
+
+  int shift = std::min(reconnect_attempts_, 20);
+  qint64 delay = std::min<qint64>(qint64(reconnect_initial_delay_) << shift,
+                                  reconnect_max_delay_);
+  // Keep half of the delay and randomize the rest, so clients dropped by
+  // the same broker restart do not reconnect in lockstep
+  delay = delay / 2 + QRandomGenerator::global()->bounded(delay / 2 + 1);
+
+  ++reconnect_attempts_;
+  ++total_reconnect_attempts_;
+  setConnectionState(ConnectionState::Reconnecting);
+  qInfo("Reconnecting in %lld ms (attempt %d)...", delay,
+        reconnect_attempts_);
+  emit reconnectScheduled(reconnect_attempts_, int(delay));
+  reconnect_timer_.start(int(delay));
+}
+
+void Client::reconnect() {
+  setConnectionState(ConnectionState::Connecting);
+  mqtt_client_->setCleanSession(!persistent_session_);
+  mqtt_client_->connectToHost();
+}
+
+}  // namespace SideAssist::Qt
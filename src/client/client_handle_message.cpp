@@ -1,83 +1,297 @@
-#include <QJsonDocument>
+#include <QElapsedTimer>
+#include <QMutexLocker>
+#include <QReadLocker>
+#include <QThreadPool>
+#include <QWriteLocker>
 #include "client.hpp"
+#include "payload.hpp"
+#include "value_validator.hpp"
 
 namespace SideAssist::Qt {
 
+void Client::rebuildDispatchTable() {
+  topic_prefix_ = "side_assist/" + mqtt_client_->clientId() + "/";
+  dispatch_table_.clear();
+  dispatch_table_.reserve(qsizetype(options_.size() * 2));
+  for (auto& option : options_.values())
+    addDispatchRoutesForOption(option.get());
+}
+
+void Client::addDispatchRoutesForOption(NamedValue* option) {
+  QString sync_topic = topic_prefix_ + "option/" + option->name();
+  dispatch_table_.insert(sync_topic + "/set",
+                         {option, TopicOperation::RemoteSet});
+  dispatch_table_.insert(sync_topic,
+                         {option, TopicOperation::RemoteSavedValue});
+}
+
 void Client::handleMessage(const QMQTT::Message& message) {
+  SIDE_ASSIST_TRACE_SCOPE("receive");
+  LatencyHistogram::ScopedTimer timer(metrics_.handle_message_time_);
   const QString& topic = message.topic();
-  QString start = "side_assist/" + mqtt_client_->clientId() + "/";
-  if (!topic.startsWith(start)) {
-    qCritical("Illegal topic prefix: %s", qUtf8Printable(topic));
-    return;
+
+  const bool wildcard = subscription_mode_ == SubscriptionMode::Wildcard;
+  bool awaiting_initial_value = true;
+
+  // Options are never removed, so the route stays valid after unlocking.
+  // The lock must not be held while setValue() runs connected slots.
+  TopicRoute route;
+  {
+    QReadLocker lock(&options_lock_);
+    auto itr = dispatch_table_.constFind(topic);
+    if (itr == dispatch_table_.constEnd()) {
+      metrics_.countReceived(ClientMetrics::TopicClass::Unknown,
+                             message.payload().size());
+      if (!topic.startsWith(topic_prefix_)) {
+        qCritical("Illegal topic prefix: %s", qUtf8Printable(topic));
+      } else if (wildcard) {
+        // Wildcard filters deliver options we do not know of
+        qDebug("Ignore message on unknown topic %s", qUtf8Printable(topic));
+        if (message.retain() && !topic.endsWith("/set")) {
+          lock.unlock();
+          keepUnroutedInitialValue(message);
+        }
+      } else {
+        qCritical("Illegal option name or operation: %s",
+                  qUtf8Printable(topic));
+      }
+      return;
+    }
+    route = itr.value();
+    if (wildcard)
+      awaiting_initial_value =
+          options_awaiting_initial_value_.contains(route.value);
   }
-  QStringList seg = topic.right(topic.length() - start.length()).split('/');
 
-  if (seg.length() == 0) {
-    qCritical("Illegal topic: %s", qUtf8Printable(topic));
+  NamedValue* option = route.value;
+  bool remoteSavedLocalValue =
+      route.operation == TopicOperation::RemoteSavedValue;
+  const auto topic_class = remoteSavedLocalValue
+                               ? ClientMetrics::TopicClass::OptionValue
+                               : ClientMetrics::TopicClass::OptionSet;
+  metrics_.countReceived(topic_class, message.payload().size());
+
+  // Before anything looks at the payload, logging included
+  const qsizetype max_size = max_payload_sizes_[int(topic_class)];
+  if (max_size >= 0 && message.payload().size() > max_size) {
+    metrics_.countOversizedPayload(topic_class);
+    qWarning("Drop oversized payload on %s: %lld > %lld bytes",
+             qUtf8Printable(topic), qint64(message.payload().size()),
+             qint64(max_size));
     return;
   }
 
-  if (seg[0] == "option") {
-    bool remoteSavedLocalValue = seg.length() == 2;
-    if (!(seg.length() == 3 && seg[2] == "set" || remoteSavedLocalValue)) {
-      qCritical("Illegal option operation: %s", qUtf8Printable(topic));
+  if (remoteSavedLocalValue) {
+    if (!awaiting_initial_value) {
+      // option/+ also echoes our own uploads and covers options that did
+      // not ask for a remote initial value
+      qDebug("Ignore remote saved value for option %s",
+             qUtf8Printable(option->name()));
       return;
-    }
-    auto itr = options_.find(seg[1]);
-    if (itr == options_.end()) {
-      qCritical("Illegal option name: %s", qUtf8Printable(topic));
+    } else if (!option->value().isUndefined()) {
+      qWarning("Ignore remote saved value for option %s",
+               qUtf8Printable(option->name()));
       return;
+    } else {
+      qInfo("Found remote saved value for option %s",
+            qUtf8Printable(option->name()));
     }
+  }
 
-    if (remoteSavedLocalValue) {
-      if (!itr->second->value().isUndefined()) {
-        qWarning("Ignore remote saved value for option %s",
-                 qUtf8Printable(seg[1]));
-        return;
-      } else {
-        qInfo("Found remote saved value for option %s", qUtf8Printable(seg[1]));
-      }
-    }
+  enqueueReceivedValue(
+      option, {message.payload(), topic, remoteSavedLocalValue,
+               max_size >= 0 ? max_size
+                             : Payload::default_max_decompressed_size});
+}
 
-    QJsonParseError error;
-    QJsonDocument doc = QJsonDocument::fromJson(message.payload(), &error);
-    auto payload_formatter = [&]() {
-      QString str = QString(message.payload())
-                        .replace(QRegularExpression("[ \t\n][ \t\n]+"), " ");
-      if (str.length() > 256)
-        str = str.left(253) + "...";
-      return str;
-    };
-    if (error.error != QJsonParseError::NoError) {
-      qCritical("Invalid json from payload(payload=\"%s\", topic=\"%s\"): %s",
-                qUtf8Printable(payload_formatter()),
-                qUtf8Printable(message.topic()),
-                qUtf8Printable(error.errorString()));
-      return;
-    }
-    auto& value = doc["value"];
-    if (value.isUndefined()) {
-      qCritical("Invalid value from json(topic=\"%s\"): %s",
-                qUtf8Printable(message.topic()),
-                qUtf8Printable(payload_formatter()));
-      return;
-    }
+void Client::keepUnroutedInitialValue(const QMQTT::Message& message) {
+  const qsizetype max_size =
+      max_payload_sizes_[int(ClientMetrics::TopicClass::OptionValue)];
+  if (max_size >= 0 && message.payload().size() > max_size)
+    return;
+  QWriteLocker lock(&options_lock_);
+  if (!initial_value_filter_subscribed_)
+    return;
+  if (dispatch_table_.contains(message.topic())) {
+    // The option was added since the lookup
+    QMetaObject::invokeMethod(
+        this, [this, message]() { handleMessage(message); },
+        ::Qt::QueuedConnection);
+    return;
+  }
+  unrouted_initial_values_.insert(message.topic(), message.payload());
+}
 
-    bool ret = itr->second->validate(value);
-    if (!ret) {
-      qCritical("Validation failed on json(topic=\"%s\"): %s",
-                qUtf8Printable(message.topic()),
-                qUtf8Printable(payload_formatter()));
-      return;
-    }
+void Client::claimUnroutedInitialValue(const NamedValue* option) {
+  const QString& topic = valueTopic(ValueKind::Option, option);
+  auto itr = unrouted_initial_values_.find(topic);
+  if (itr == unrouted_initial_values_.end())
+    return;
+  // Routed like a fresh delivery, once options_lock_ is released
+  QMQTT::Message message(0, topic, *itr, 2, true);
+  unrouted_initial_values_.erase(itr);
+  QMetaObject::invokeMethod(
+      this, [this, message]() { handleMessage(message); },
+      ::Qt::QueuedConnection);
+}
 
-    itr->second->setValue(value);
+void Client::enqueueReceivedValue(NamedValue* option,
+                                  ReceivedValue&& received) {
+  auto& queue = inbound_queues_[option];
+  // The front message is already being parsed on the pool
+  const size_t waiting = queue.messages.size() -
+                         (validation_pool_ != nullptr && queue.in_flight);
+  if (!received.remote_saved_value && option->compactsRemoteSets() &&
+      waiting > 0 && !queue.messages.back().remote_saved_value) {
+    // Latest wins, the replaced /set is never parsed
+    queue.messages.back() = std::move(received);
+    metrics_.countCompactedSet();
+    return;
+  }
+  queue.messages.push_back(std::move(received));
+  if (queue.in_flight)
+    return;
+  queue.in_flight = true;
+  if (validation_pool_ != nullptr) {
+    startValidation(option);
+    return;
+  }
+  if (inbound_pending_.empty())
+    QMetaObject::invokeMethod(this, &Client::drainInboundQueues,
+                              ::Qt::QueuedConnection);
+  inbound_pending_.push_back(option);
+}
 
-    if (!remoteSavedLocalValue) {
-      qInfo("Remote changed option %s: %s", qUtf8Printable(seg[1]),
-            qUtf8Printable(payload_formatter()));
+void Client::drainInboundQueues() {
+  std::vector<NamedValue*> options;
+  options.swap(inbound_pending_);
+  for (NamedValue* option : options) {
+    auto& queue = inbound_queues_[option];
+    std::deque<ReceivedValue> messages;
+    messages.swap(queue.messages);
+    queue.in_flight = false;
+    for (const auto& received : messages) {
+      LatencyHistogram::ScopedTimer timer(metrics_.process_received_time_);
+      QJsonValue value;
+      if (readAndValidate(received, option->validator(), value))
+        applyReceivedValue(option, received, value);
     }
   }
 }
 
+bool Client::readAndValidate(
+    const ReceivedValue& received,
+    const std::shared_ptr<ValueValidator::Abstract>& validator,
+    QJsonValue& value) {
+  QString error;
+  bool parsed;
+  {
+    SIDE_ASSIST_TRACE_SCOPE("parse");
+    parsed = Payload::readValue(received.payload, value, &error,
+                                received.max_decompressed_size);
+  }
+  if (!parsed) {
+    metrics_.countParseFailure();
+    qCritical("Invalid payload(payload=\"%s\", topic=\"%s\"): %s",
+              qUtf8Printable(Payload::toDisplayString(received.payload)),
+              qUtf8Printable(received.topic), qUtf8Printable(error));
+    return false;
+  }
+  if (value.isUndefined()) {
+    metrics_.countParseFailure();
+    qCritical("Invalid value from payload(topic=\"%s\"): %s",
+              qUtf8Printable(received.topic),
+              qUtf8Printable(Payload::toDisplayString(received.payload)));
+    return false;
+  }
+
+  bool ret;
+  {
+    SIDE_ASSIST_TRACE_SCOPE("validate");
+    ret = validator == nullptr || validator->program().run(value);
+  }
+  if (!ret) {
+    metrics_.countValidationFailure();
+    qCritical("Validation failed on json(topic=\"%s\"): %s",
+              qUtf8Printable(received.topic),
+              qUtf8Printable(Payload::toDisplayString(received.payload)));
+    return false;
+  }
+  return true;
+}
+
+void Client::applyReceivedValue(NamedValue* option,
+                                const ReceivedValue& received,
+                                const QJsonValue& value,
+                                QString display) {
+  // A local value may have been set while the payload was validated
+  if (received.remote_saved_value && !option->value().isUndefined()) {
+    qWarning("Ignore remote saved value for option %s",
+             qUtf8Printable(option->name()));
+    return;
+  }
+
+  option->setValue(value);
+
+  if (!received.remote_saved_value) {
+    if (display.isEmpty())
+      display = Payload::toDisplayString(received.payload);
+    qInfo("Remote changed option %s: %s", qUtf8Printable(option->name()),
+          qUtf8Printable(display));
+  }
+}
+
+void Client::startValidation(NamedValue* option) {
+  auto& queue = inbound_queues_[option];
+  // The validator is read here, as setValidator() runs on this thread
+  {
+    QMutexLocker lock(&validations_mutex_);
+    ++validations_in_flight_;
+  }
+  validation_pool_->start([this, option, validator = option->validator(),
+                           received = queue.messages.front()]() {
+    QElapsedTimer timer;
+    timer.start();
+    QJsonValue value;
+    bool valid = readAndValidate(received, validator, value);
+    QString display;
+    // Formatted here to keep the regex off the client's thread
+    if (valid && !received.remote_saved_value)
+      display = Payload::toDisplayString(received.payload);
+    const qint64 validate_nsec = timer.nsecsElapsed();
+    // Dropped if the client is gone by then
+    QMetaObject::invokeMethod(
+        this,
+        [this, option, valid, value, display, validate_nsec]() {
+          finishValidation(option, valid, value, display, validate_nsec);
+        },
+        ::Qt::QueuedConnection);
+    QMutexLocker lock(&validations_mutex_);
+    if (--validations_in_flight_ == 0)
+      validations_done_.wakeAll();
+  });
+}
+
+void Client::finishValidation(NamedValue* option,
+                              bool valid,
+                              const QJsonValue& value,
+                              const QString& display,
+                              qint64 validate_nsec) {
+  auto& queue = inbound_queues_[option];
+  ReceivedValue received = std::move(queue.messages.front());
+  queue.messages.pop_front();
+  QElapsedTimer timer;
+  timer.start();
+  if (valid)
+    applyReceivedValue(option, received, value, display);
+  metrics_.process_received_time_.record(
+      (validate_nsec + timer.nsecsElapsed()) / 1000);
+  // setValue() may have run slots that queued more messages
+  auto& next = inbound_queues_[option];
+  if (next.messages.empty())
+    next.in_flight = false;
+  else
+    startValidation(option);
+}
+
 }  // namespace SideAssist::Qt
@@ -48,10 +48,9 @@ static void messageHandler(QtMsgType type,
                   .arg(func_name)
                   .arg(msg);
   
-  {
-    QMutexLocker locker(&log_mutex);
-    fprintf(stderr, "%s", qPrintable(line));
-  }
+  // Validation pool threads log as well
+  QMutexLocker locker(&log_mutex);
+  fprintf(stderr, "%s", qPrintable(line));
   log_file->write(line.toLocal8Bit());
   log_file->flush();
 }
@@ -134,10 +133,12 @@ void Client::logUnsubscribed(const QString& topic) {
 void Client::handleMqttError(const QMQTT::ClientError error) {
   if (error == QMQTT::ClientError::SocketConnectionRefusedError) {
     qCritical("Could not connect to server!");
-    qInfo("Exiting...");
-    exit(1);
+  } else {
+    qCritical("MQTT Client error: %d", error);
   }
-  qCritical("MQTT Client error: %d", error);
+  // A failed connection attempt does not emit disconnected()
+  if (connection_state_ == ConnectionState::Connecting)
+    scheduleReconnect();
 }
 
 }  // namespace SideAssist::Qt
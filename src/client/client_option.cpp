@@ -1,47 +1,115 @@
 #include <QJsonDocument>
 #include <QJsonObject>
 #include <QJsonValue>
-#include <QReadLocker>
 #include <QWriteLocker>
 #include "client.hpp"
+#include "payload.hpp"
 #include "value_validator.hpp"
 
 namespace SideAssist::Qt {
 
 std::shared_ptr<NamedValue> Client::addOption(
     const QString& name,
-    bool accept_remote_initial_value) {
+    bool accept_remote_initial_value,
+    const DeliveryPolicy& policy) {
+  if (auto* existing = options_.find(name)) {
+    qWarning("Trying to create existed option %s", qUtf8Printable(name));
+    return *existing;
+  }
+  auto created = createOption(name, policy);
   QWriteLocker lock(&options_lock_);
-  auto itr = options_.emplace(
-      name,
-      std::make_shared<NamedValue>(name, QJsonValue(QJsonValue::Undefined)));
+  auto itr = options_.emplace(name, std::move(created));
+  const auto& opt = *itr.first;
 
   if (itr.second) {
     qInfo("Created option %s", qUtf8Printable(name));
-    connect(itr.first->second.get(), &NamedValue::valueChanged, this,
-            &Client::uploadChangedOptionValue);
-    connect(itr.first->second.get(), &NamedValue::validatorChanged, this,
-            &Client::uploadChangedOptionValidator);
-    if (mqtt_client_->isConnectedToHost())
-      setupSubscriptionsForOption(itr.first->second.get(),
-                                  accept_remote_initial_value);
+    addDispatchRoutesForOption(opt.get());
+    if (!mqtt_client_->isConnectedToHost()) {
+      // Subscriptions are set up on connection
+    } else if (subscription_mode_ == SubscriptionMode::Wildcard) {
+      // option/+/set already covers the new option
+      if (accept_remote_initial_value) {
+        awaitInitialValueOfOption(opt.get());
+        subscribeInitialValueFilter({opt.get()});
+      }
+    } else {
+      setupSubscriptionsForOption(opt.get(), accept_remote_initial_value);
+    }
   } else {
-    qWarning("Trying to create existed parameter %s", qUtf8Printable(name));
+    qWarning("Trying to create existed option %s", qUtf8Printable(name));
+  }
+  // uploadOptionValue(opt.get());
+  return opt;
+}
+
+std::vector<std::shared_ptr<NamedValue> > Client::addOptions(
+    const QStringList& names,
+    bool accept_remote_initial_value,
+    const DeliveryPolicy& policy) {
+  QWriteLocker lock(&options_lock_);
+  // Only names not taken yet get a value created
+  std::vector<std::pair<QString, std::shared_ptr<NamedValue> > > items;
+  QSet<QString> created_names;
+  for (const auto& name : names) {
+    if (options_.find(name) != nullptr || created_names.contains(name)) {
+      qWarning("Trying to create existed option %s", qUtf8Printable(name));
+      continue;
+    }
+    created_names.insert(name);
+    items.emplace_back(name, createOption(name, policy));
+  }
+
+  int created = 0;
+  std::vector<const NamedValue*> awaiting;
+  const bool connected = mqtt_client_->isConnectedToHost();
+  // options_lock_ keeps every name free until emplaced
+  for (const auto& emplaced : options_.emplace(std::move(items))) {
+    const auto* ptr = emplaced.first;
+    ++created;
+    addDispatchRoutesForOption(ptr->get());
+    if (!connected)
+      continue;
+    if (subscription_mode_ == SubscriptionMode::Wildcard) {
+      if (accept_remote_initial_value) {
+        awaitInitialValueOfOption(ptr->get());
+        awaiting.push_back(ptr->get());
+      }
+    } else {
+      // qmqtt sends one SUBSCRIBE per topic
+      setupSubscriptionsForOption(ptr->get(), accept_remote_initial_value);
+    }
   }
-  // uploadOptionValue(itr.first->second.get());
-  return itr.first->second;
+  if (!awaiting.empty())
+    subscribeInitialValueFilter(awaiting);
+  qInfo("Created %d options", created);
+
+  std::vector<std::shared_ptr<NamedValue> > values;
+  values.reserve(names.size());
+  for (const auto& name : names)
+    values.push_back(*options_.find(name));
+  return values;
+}
+
+std::shared_ptr<NamedValue> Client::createOption(
+    const QString& name,
+    const DeliveryPolicy& policy) {
+  // Set up before inserting, readers may find the value right away
+  auto option =
+      std::make_shared<NamedValue>(name, QJsonValue(QJsonValue::Undefined));
+  option->setDeliveryPolicy(policy);
+  connect(option.get(), &NamedValue::valueChanged, this,
+          &Client::uploadChangedOptionValue);
+  connect(option.get(), &NamedValue::validatorChanged, this,
+          &Client::uploadChangedOptionValidator);
+  return option;
 }
 
 std::shared_ptr<NamedValue> Client::option(
     const QString& name,
     bool create_if_not_found,
     bool accept_remote_initial_value_if_created) {
-  QReadLocker lock(&options_lock_);
-  auto itr = options_.find(name);
-  if (itr != options_.end())
-    return itr->second;
-
-  lock.unlock();
+  if (auto* ptr = options_.find(name))
+    return *ptr;
 
   if (create_if_not_found)
     return addOption(name, accept_remote_initial_value_if_created);
@@ -49,25 +117,32 @@ std::shared_ptr<NamedValue> Client::option(
 }
 
 void Client::uploadChangedOptionValue() {
-  if (!mqtt_client_->isConnectedToHost())
-    return;
   const auto* opt = dynamic_cast<const NamedValue*>(sender());
   assert(opt != nullptr);
-  assert(options_.find(opt->name()) != options_.end());
-  uploadOptionValue(opt);
+  assert(options_.find(opt->name()) != nullptr);
+  markValueUnsynced(ValueKind::Option, opt);
+  if (!acceptsPublishes())
+    return;
+  if (opt->maxPublishRate() > 0)
+    throttleValue(ValueKind::Option, opt);
+  else if (publish_coalescing_interval_ >= 0 && opt->coalescing())
+    markValueDirty(ValueKind::Option, opt);
+  else
+    uploadOptionValue(opt);
 }
 
 void Client::uploadChangedOptionValidator() {
-  if (!mqtt_client_->isConnectedToHost())
-    return;
   const auto* opt = dynamic_cast<const NamedValue*>(sender());
   assert(opt != nullptr);
-  assert(options_.find(opt->name()) != options_.end());
+  assert(options_.find(opt->name()) != nullptr);
+  markValueUnsynced(ValueKind::Option, opt);
+  if (!acceptsPublishes())
+    return;
   uploadOptionValidator(opt);
 }
 
 void Client::uploadOptionValue(const NamedValue* option) {
-  if (!mqtt_client_->isConnectedToHost()) {
+  if (!acceptsPublishes()) {
     qWarning("Trying to upload option %s when not connected",
              qUtf8Printable(option->name()));
     return;
@@ -77,35 +152,34 @@ void Client::uploadOptionValue(const NamedValue* option) {
               qUtf8Printable(option->name()));
     return;
   }
-  QMQTT::Message message(
-      0,
-      "side_assist/" + mqtt_client_->clientId() + "/option/" + option->name(),
-      QJsonDocument(QJsonObject({qMakePair("value", option->value())}))
-          .toJson(QJsonDocument::Compact),
-      2, true);
+  Payload::writeValue(option->value(), publish_buffer_, payload_encoding_);
+  QMQTT::Message message(0, valueTopic(ValueKind::Option, option),
+                         compressIfLarge(publish_buffer_),
+                         option->deliveryPolicy().qos,
+                         option->deliveryPolicy().retain);
   qInfo("Uploading option %s...", qUtf8Printable(option->name()));
-  mqtt_client_->publish(message);
+  publishMessage(message, ClientMetrics::TopicClass::OptionValue,
+                 {option, false, option->generation_, {}});
 }
 
 void Client::uploadOptionValidator(const NamedValue* option) {
-  if (!mqtt_client_->isConnectedToHost()) {
+  if (!acceptsPublishes()) {
     qWarning("Trying to upload validator of option %s when not connected",
              qUtf8Printable(option->name()));
     return;
   }
-  QByteArray buf;
+  QByteArray buf, digest;
   if (option->validator() != nullptr) {
-    buf = QJsonDocument(
-              QJsonObject({qMakePair("validator",
-                                     option->validator()->serializeToJson())}))
-              .toJson(QJsonDocument::Compact);
+    buf = compressIfLarge(
+        option->validator()->serializedPayload(payload_encoding_));
+    digest = option->validator()->digest();
   }
-  QMQTT::Message message(0,
-                         "side_assist/" + mqtt_client_->clientId() +
-                             "/option/" + option->name() + "/validator",
-                         buf, 2, true);
+  QMQTT::Message message(0, validatorTopic(ValueKind::Option, option), buf,
+                         2, true);
   qInfo("Uploading validator for option %s...", qUtf8Printable(option->name()));
-  mqtt_client_->publish(message);
+  option->published_validator_digest_.clear();
+  publishMessage(message, ClientMetrics::TopicClass::OptionValidator,
+                 {option, true, 0, digest});
 }
 
 void Client::unsubscribeInitialValueWhenOptionIsNotUndefined() {
@@ -113,11 +187,20 @@ void Client::unsubscribeInitialValueWhenOptionIsNotUndefined() {
     return;
   const auto* opt = dynamic_cast<const NamedValue*>(sender());
   assert(opt != nullptr);
-  assert(options_.find(opt->name()) != options_.end());
+  assert(options_.find(opt->name()) != nullptr);
   if (!opt->value().isUndefined()) {
-    auto sync_topic =
-        "side_assist/" + mqtt_client_->clientId() + "/option/" + opt->name();
-    mqtt_client_->unsubscribe(sync_topic);
+    if (subscription_mode_ == SubscriptionMode::Wildcard) {
+      QWriteLocker lock(&options_lock_);
+      options_awaiting_initial_value_.remove(opt);
+      if (options_awaiting_initial_value_.isEmpty() &&
+          initial_value_filter_subscribed_) {
+        mqtt_client_->unsubscribe(topic_prefix_ + "option/+");
+        initial_value_filter_subscribed_ = false;
+        unrouted_initial_values_.clear();
+      }
+    } else {
+      mqtt_client_->unsubscribe(valueTopic(ValueKind::Option, opt));
+    }
     disconnect(opt, &NamedValue::valueChanged, this,
                &Client::unsubscribeInitialValueWhenOptionIsNotUndefined);
   }
@@ -127,8 +210,7 @@ void Client::setupSubscriptionsForOption(const NamedValue* option,
                                          bool accept_remote_initial_value) {
   if (!mqtt_client_->isConnectedToHost())
     return;
-  auto sync_topic =
-      "side_assist/" + mqtt_client_->clientId() + "/option/" + option->name();
+  const QString& sync_topic = valueTopic(ValueKind::Option, option);
   auto remote_set_topic = sync_topic + "/set";
   mqtt_client_->subscribe(remote_set_topic, 1);
 
@@ -139,4 +221,43 @@ void Client::setupSubscriptionsForOption(const NamedValue* option,
   }
 }
 
+void Client::setupWildcardSubscriptions() {
+  if (!mqtt_client_->isConnectedToHost())
+    return;
+  QWriteLocker lock(&options_lock_);
+  options_awaiting_initial_value_.clear();
+  for (auto& option : options_.values()) {
+    if (option->value().isUndefined())
+      awaitInitialValueOfOption(option.get());
+  }
+
+  mqtt_client_->subscribe(topic_prefix_ + "option/+/set", 1);
+  // Retained values are delivered again
+  unrouted_initial_values_.clear();
+  initial_value_filter_subscribed_ = !options_awaiting_initial_value_.isEmpty();
+  if (initial_value_filter_subscribed_)
+    mqtt_client_->subscribe(topic_prefix_ + "option/+", 2);
+}
+
+void Client::subscribeInitialValueFilter(
+    const std::vector<const NamedValue*>& added) {
+  if (!initial_value_filter_subscribed_) {
+    // Delivers the retained values of the added options with the rest
+    mqtt_client_->subscribe(topic_prefix_ + "option/+", 2);
+    initial_value_filter_subscribed_ = true;
+    return;
+  }
+  // Subscribing again would make the broker resend every retained value.
+  // Those of the added options already came by before they were known.
+  for (const auto* option : added)
+    claimUnroutedInitialValue(option);
+}
+
+void Client::awaitInitialValueOfOption(const NamedValue* option) {
+  options_awaiting_initial_value_.insert(option);
+  connect(option, &NamedValue::valueChanged, this,
+          &Client::unsubscribeInitialValueWhenOptionIsNotUndefined,
+          ::Qt::UniqueConnection);
+}
+
 }  // namespace SideAssist::Qt
@@ -2,39 +2,79 @@
 #include <QJsonDocument>
 #include <QJsonObject>
 #include <QJsonValue>
-#include <QReadLocker>
-#include <QWriteLocker>
+#include "payload.hpp"
 #include "value_validator.hpp"
 
 namespace SideAssist::Qt {
 
-std::shared_ptr<NamedValue> Client::addParameter(const QString& name) {
-  QWriteLocker lock(&parameters_lock_);
-  auto itr = parameters_.emplace(
-      name,
-      std::make_shared<NamedValue>(name, QJsonValue(QJsonValue::Undefined)));
-
+std::shared_ptr<NamedValue> Client::addParameter(
+    const QString& name,
+    const DeliveryPolicy& policy) {
+  if (auto* existing = parameters_.find(name)) {
+    qWarning("Trying to create existed parameter %s", qUtf8Printable(name));
+    return *existing;
+  }
+  // Another thread may still win the race for the name
+  auto itr = parameters_.emplace(name, createParameter(name, policy));
   if (itr.second) {
     qInfo("Created parameter %s", qUtf8Printable(name));
-    connect(itr.first->second.get(), &NamedValue::valueChanged, this,
-            &Client::uploadChangedParameterValue);
-    connect(itr.first->second.get(), &NamedValue::validatorChanged, this,
-            &Client::uploadChangedParameterValidator);
   } else {
     qWarning("Trying to create existed parameter %s", qUtf8Printable(name));
   }
-  // uploadParameterValue(itr.first->second.get());
-  return itr.first->second;
+  // uploadParameterValue(itr.first->get());
+  return *itr.first;
+}
+
+std::vector<std::shared_ptr<NamedValue> > Client::addParameters(
+    const QStringList& names,
+    const DeliveryPolicy& policy) {
+  // Only names not taken yet get a value created
+  std::vector<std::pair<QString, std::shared_ptr<NamedValue> > > items;
+  QSet<QString> created_names;
+  for (const auto& name : names) {
+    if (parameters_.find(name) != nullptr || created_names.contains(name)) {
+      qWarning("Trying to create existed parameter %s", qUtf8Printable(name));
+      continue;
+    }
+    created_names.insert(name);
+    items.emplace_back(name, createParameter(name, policy));
+  }
+
+  int created = 0;
+  for (auto& [ptr, inserted] : parameters_.emplace(std::move(items))) {
+    if (inserted)
+      ++created;
+    else
+      qWarning("Trying to create existed parameter %s",
+               qUtf8Printable((*ptr)->name()));
+  }
+  qInfo("Created %d parameters", created);
+
+  std::vector<std::shared_ptr<NamedValue> > values;
+  values.reserve(names.size());
+  for (const auto& name : names)
+    values.push_back(*parameters_.find(name));
+  return values;
+}
+
+std::shared_ptr<NamedValue> Client::createParameter(
+    const QString& name,
+    const DeliveryPolicy& policy) {
+  // Set up before inserting, readers may find the value right away
+  auto param =
+      std::make_shared<NamedValue>(name, QJsonValue(QJsonValue::Undefined));
+  param->setDeliveryPolicy(policy);
+  connect(param.get(), &NamedValue::valueChanged, this,
+          &Client::uploadChangedParameterValue);
+  connect(param.get(), &NamedValue::validatorChanged, this,
+          &Client::uploadChangedParameterValidator);
+  return param;
 }
 
 std::shared_ptr<NamedValue> Client::parameter(const QString& name,
                                               bool create_if_not_found) {
-  QReadLocker lock(&parameters_lock_);
-  auto itr = parameters_.find(name);
-  if (itr != parameters_.end())
-    return itr->second;
-
-  lock.unlock();
+  if (auto* ptr = parameters_.find(name))
+    return *ptr;
 
   if (create_if_not_found)
     return addParameter(name);
@@ -42,25 +82,32 @@ std::shared_ptr<NamedValue> Client::parameter(const QString& name,
 }
 
 void Client::uploadChangedParameterValue() {
-  if (!mqtt_client_->isConnectedToHost())
-    return;
   const auto* param = dynamic_cast<const NamedValue*>(sender());
   assert(param != nullptr);
-  assert(parameters_.find(param->name()) != parameters_.end());
-  uploadParameterValue(param);
+  assert(parameters_.find(param->name()) != nullptr);
+  markValueUnsynced(ValueKind::Parameter, param);
+  if (!acceptsPublishes())
+    return;
+  if (param->maxPublishRate() > 0)
+    throttleValue(ValueKind::Parameter, param);
+  else if (publish_coalescing_interval_ >= 0 && param->coalescing())
+    markValueDirty(ValueKind::Parameter, param);
+  else
+    uploadParameterValue(param);
 }
 
 void Client::uploadChangedParameterValidator() {
-  if (!mqtt_client_->isConnectedToHost())
-    return;
   const auto* param = dynamic_cast<const NamedValue*>(sender());
   assert(param != nullptr);
-  assert(parameters_.find(param->name()) != parameters_.end());
+  assert(parameters_.find(param->name()) != nullptr);
+  markValueUnsynced(ValueKind::Parameter, param);
+  if (!acceptsPublishes())
+    return;
   uploadParameterValidator(param);
 }
 
 void Client::uploadParameterValue(const NamedValue* parameter) {
-  if (!mqtt_client_->isConnectedToHost()) {
+  if (!acceptsPublishes()) {
     qWarning("Trying to upload parameter %s when not connected",
              qUtf8Printable(parameter->name()));
     return;
@@ -70,35 +117,34 @@ void Client::uploadParameterValue(const NamedValue* parameter) {
               qUtf8Printable(parameter->name()));
     return;
   }
-  QMQTT::Message message(
-      0,
-      "side_assist/" + mqtt_client_->clientId() + "/param/" + parameter->name(),
-      QJsonDocument(QJsonObject({qMakePair("value", parameter->value())}))
-          .toJson(QJsonDocument::Compact),
-      2, true);
+  Payload::writeValue(parameter->value(), publish_buffer_, payload_encoding_);
+  QMQTT::Message message(0, valueTopic(ValueKind::Parameter, parameter),
+                         compressIfLarge(publish_buffer_),
+                         parameter->deliveryPolicy().qos,
+                         parameter->deliveryPolicy().retain);
   qInfo("Uploading parameter %s...", qUtf8Printable(parameter->name()));
-  mqtt_client_->publish(message);
+  publishMessage(message, ClientMetrics::TopicClass::ParameterValue,
+                 {parameter, false, parameter->generation_, {}});
 }
 
 void Client::uploadParameterValidator(const NamedValue* parameter) {
-  if (!mqtt_client_->isConnectedToHost()) {
+  if (!acceptsPublishes()) {
     qWarning("Trying to upload option %s when not connected",
              qUtf8Printable(parameter->name()));
     return;
   }
-  QByteArray buf;
+  QByteArray buf, digest;
   if (parameter->validator() != nullptr) {
-    buf = QJsonDocument(
-              QJsonObject({qMakePair(
-                  "validator", parameter->validator()->serializeToJson())}))
-              .toJson(QJsonDocument::Compact);
+    buf = compressIfLarge(
+        parameter->validator()->serializedPayload(payload_encoding_));
+    digest = parameter->validator()->digest();
   }
-  QMQTT::Message message(0,
-                         "side_assist/" + mqtt_client_->clientId() +
-                             "/param/" + parameter->name() + "/validator",
+  QMQTT::Message message(0, validatorTopic(ValueKind::Parameter, parameter),
                          buf, 2, true);
   qInfo("Uploading validator for parameter %s...", qUtf8Printable(parameter->name()));
-  mqtt_client_->publish(message);
+  parameter->published_validator_digest_.clear();
+  publishMessage(message, ClientMetrics::TopicClass::ParameterValidator,
+                 {parameter, true, 0, digest});
 }
 
 }  // namespace SideAssist::Qt
@@ -0,0 +1,268 @@
+#include "client.hpp"
+#include "value_validator.hpp"
+
+namespace SideAssist::Qt {
+
+void Client::setPublishCoalescingInterval(int msec) {
+  publish_coalescing_interval_ = msec;
+  if (msec < 0) {
+    publish_flush_timer_.stop();
+    flushDirtyValues();
+  } else if (publish_flush_timer_.isActive()) {
+    publish_flush_timer_.start(msec);
+  }
+}
+
+void Client::setPayloadEncoding(Payload::Encoding encoding) {
+  if (encoding == payload_encoding_)
+    return;
+  payload_encoding_ = encoding;
+  // The broker retains validators in the old encoding
+  invalidateClientIdCaches();
+  if (mqtt_client_->isConnectedToHost()) {
+    uploadPayloadEncoding();
+    uploadAll();
+  }
+}
+
+void Client::uploadPayloadEncoding() {
+  QMQTT::Message message(
+      0, topic_prefix_ + "encoding",
+      payload_encoding_ == Payload::Encoding::Cbor ? "cbor" : "json", 1, true);
+  qInfo("Uploading payload encoding...");
+  sendMessage(message, ClientMetrics::TopicClass::Control);
+}
+
+void Client::setMetricsPublishInterval(int msec) {
+  metrics_publish_interval_ = msec;
+  if (msec > 0)
+    metrics_timer_.start(msec);
+  else
+    metrics_timer_.stop();
+}
+
+void Client::publishMetrics() {
+  if (!mqtt_client_->isConnectedToHost())
+    return;
+  Payload::writeValue(metrics_.toJson(), publish_buffer_, payload_encoding_);
+  QMQTT::Message message(0, topic_prefix_ + "metrics", publish_buffer_, 0,
+                         true);
+  sendMessage(message, ClientMetrics::TopicClass::Control);
+}
+
+QByteArray Client::compressIfLarge(const QByteArray& payload) const {
+  if (compression_threshold_ < 0 || payload.size() < compression_threshold_)
+    return payload;
+  return Payload::compress(payload);
+}
+
+void Client::markValueDirty(ValueKind kind, const NamedValue* value) {
+  // Only the latest value is read at flush time, so one entry is enough
+  if (dirty_value_set_.contains(value))
+    return;
+  dirty_value_set_.insert(value);
+  dirty_values_.emplace_back(kind, value);
+  if (!publish_flush_timer_.isActive())
+    publish_flush_timer_.start(publish_coalescing_interval_);
+}
+
+void Client::flushDirtyValues() {
+  std::vector<std::pair<ValueKind, const NamedValue*> > values;
+  values.swap(dirty_values_);
+  dirty_value_set_.clear();
+  if (!acceptsPublishes())
+    return;
+  for (auto& [kind, value] : values) {
+    if (kind == ValueKind::Option)
+      uploadOptionValue(value);
+    else
+      uploadParameterValue(value);
+  }
+}
+
+const QString& Client::valueTopic(ValueKind kind, const NamedValue* value) {
+  if (value->value_topic_.isEmpty()) {
+    value->value_topic_ =
+        topic_prefix_ + (kind == ValueKind::Option ? "option/" : "param/") +
+        value->name();
+  }
+  return value->value_topic_;
+}
+
+const QString& Client::validatorTopic(ValueKind kind, const NamedValue* value) {
+  if (value->validator_topic_.isEmpty())
+    value->validator_topic_ = valueTopic(kind, value) + "/validator";
+  return value->validator_topic_;
+}
+
+void Client::invalidateClientIdCaches() {
+  dropPendingPublishes();
+  // Queued messages carry topics of the old id
+  offline_messages_.clear();
+  offline_topics_.clear();
+  offline_queue_overflowed_ = false;
+  for (auto& option : options_.values()) {
+    option->value_topic_.clear();
+    option->validator_topic_.clear();
+  }
+  for (auto& parameter : parameters_.values()) {
+    parameter->value_topic_.clear();
+    parameter->validator_topic_.clear();
+  }
+  forgetPublishedValues();
+}
+
+void Client::forgetPublishedValues() {
+  uploaded_all_ = false;
+  auto forget = [this](ValueKind kind, NamedValue* value) {
+    value->published_validator_digest_.clear();
+    value->published_generation_ = 0;
+    if (!isSynced(value))
+      unsynced_values_.insert(value, kind);
+  };
+  for (auto& option : options_.values())
+    forget(ValueKind::Option, option.get());
+  for (auto& parameter : parameters_.values())
+    forget(ValueKind::Parameter, parameter.get());
+}
+
+void Client::handlePublished(const QMQTT::Message& message, quint16 id) {
+  auto sent = publish_times_.find(id);
+  if (sent != publish_times_.end()) {
+    metrics_.publish_ack_latency_.record((clock_.nsecsElapsed() - *sent) /
+                                         1000);
+    publish_times_.erase(sent);
+  }
+  auto itr = pending_publishes_.find(id);
+  if (itr == pending_publishes_.end())
+    return;
+  const NamedValue* value = itr->value;
+  if (message.topic() ==
+      (itr->validator ? value->validator_topic_ : value->value_topic_))
+    acknowledgePublish(*itr);
+  pending_publishes_.erase(itr);
+}
+
+void Client::dropPendingPublishes() {
+  // Unacknowledged publishes may or may not have reached the broker
+  pending_publishes_.clear();
+  publish_times_.clear();
+}
+
+void Client::markValueUnsynced(ValueKind kind, const NamedValue* value) {
+  unsynced_values_.insert(value, kind);
+}
+
+bool Client::isSynced(const NamedValue* value) const {
+  // Undefined values are never published
+  if (value->generation_ != value->published_generation_ &&
+      !value->value().isUndefined())
+    return false;
+  return value->validator() == nullptr ||
+         value->validator()->digest() == value->published_validator_digest_;
+}
+
+void Client::trackPublish(quint16 id,
+                          quint8 qos,
+                          const PendingPublish& publish) {
+  // qmqtt reports QoS 0 publishes from within publish(), before we know
+  // the id, and there is no acknowledgement to wait for anyway
+  if (qos == 0)
+    acknowledgePublish(publish);
+  else
+    pending_publishes_.insert(id, publish);
+}
+
+void Client::acknowledgePublish(const PendingPublish& publish) {
+  const NamedValue* value = publish.value;
+  if (publish.validator)
+    value->published_validator_digest_ = publish.digest;
+  else
+    value->published_generation_ = publish.generation;
+  if (isSynced(value))
+    unsynced_values_.remove(value);
+}
+
+void Client::resyncUnsyncedValues(const QSet<QString>& sent_topics) {
+  qInfo("Resyncing %d changed values...", int(unsynced_values_.size()));
+  // Uploads may acknowledge, and thus remove, entries right away
+  const auto values = unsynced_values_;
+  for (auto itr = values.cbegin(); itr != values.cend(); ++itr) {
+    const NamedValue* value = itr.key();
+    const bool option = itr.value() == ValueKind::Option;
+    if (!value->value().isUndefined() &&
+        value->generation_ != value->published_generation_ &&
+        !sent_topics.contains(valueTopic(itr.value(), value))) {
+      if (option)
+        uploadOptionValue(value);
+      else
+        uploadParameterValue(value);
+    }
+    if (value->validator() &&
+        value->validator()->digest() != value->published_validator_digest_ &&
+        !sent_topics.contains(validatorTopic(itr.value(), value))) {
+      if (option)
+        uploadOptionValidator(value);
+      else
+        uploadParameterValidator(value);
+    }
+  }
+}
+
+bool Client::acceptsPublishes() const {
+  return persistent_session_ || mqtt_client_->isConnectedToHost();
+}
+
+void Client::publishMessage(const QMQTT::Message& message,
+                            ClientMetrics::TopicClass topic_class,
+                            const PendingPublish& publish) {
+  if (mqtt_client_->isConnectedToHost())
+    trackPublish(sendMessage(message, topic_class), message.qos(), publish);
+  else
+    enqueueOfflineMessage(message, topic_class, publish);
+}
+
+quint16 Client::sendMessage(const QMQTT::Message& message,
+                            ClientMetrics::TopicClass topic_class) {
+  SIDE_ASSIST_TRACE_SCOPE("publish");
+  metrics_.countPublished(topic_class, message.payload().size());
+  quint16 id = mqtt_client_->publish(message);
+  if (message.qos() > 0)
+    publish_times_.insert(id, clock_.nsecsElapsed());
+  return id;
+}
+
+void Client::enqueueOfflineMessage(const QMQTT::Message& message,
+                                   ClientMetrics::TopicClass topic_class,
+                                   const PendingPublish& publish) {
+  auto itr = offline_messages_.find(message.topic());
+  if (itr != offline_messages_.end()) {
+    *itr = {message, topic_class, publish};
+    return;
+  }
+  if (offline_messages_.size() >= offline_queue_capacity_) {
+    // The reconnect will upload everything instead
+    if (!offline_queue_overflowed_)
+      qWarning("Offline queue is full, falling back to a full upload");
+    offline_queue_overflowed_ = true;
+    return;
+  }
+  offline_messages_.insert(message.topic(), {message, topic_class, publish});
+  offline_topics_.append(message.topic());
+}
+
+QSet<QString> Client::flushOfflineMessages() {
+  qInfo("Flushing %d queued messages...", int(offline_topics_.size()));
+  auto messages = std::move(offline_messages_);
+  auto topics = std::move(offline_topics_);
+  offline_messages_.clear();
+  offline_topics_.clear();
+  for (const auto& topic : topics) {
+    const auto& queued = messages[topic];
+    trackPublish(sendMessage(queued.message, queued.topic_class),
+                 queued.message.qos(), queued.publish);
+  }
+  return QSet<QString>(topics.cbegin(), topics.cend());
+}
+
+}  // namespace SideAssist::Qt
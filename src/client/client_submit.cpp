@@ -0,0 +1,37 @@
+#include "client.hpp"
+
+namespace SideAssist::Qt {
+
+// Upper bound of updates applied per event loop turn
+static constexpr int submitted_values_batch_size = 1024;
+
+bool Client::submitValue(const std::shared_ptr<NamedValue>& target,
+                         const QJsonValue& value) {
+  if (!submitted_values_.tryPush({target, value}))
+    return false;
+  // Only the first update after a drain posts an event
+  if (!submitted_values_scheduled_.exchange(true, std::memory_order_acq_rel))
+    QMetaObject::invokeMethod(this, &Client::applySubmittedValues,
+                              ::Qt::QueuedConnection);
+  return true;
+}
+
+void Client::applySubmittedValues() {
+  // Cleared first, so updates pushed while draining schedule another run
+  submitted_values_scheduled_.store(false, std::memory_order_release);
+
+  SubmittedValue update;
+  int count = 0;
+  while (count < submitted_values_batch_size &&
+         submitted_values_.tryPop(update)) {
+    update.target->setValue(update.value);
+    ++count;
+  }
+
+  if (count == submitted_values_batch_size &&
+      !submitted_values_scheduled_.exchange(true, std::memory_order_acq_rel))
+    QMetaObject::invokeMethod(this, &Client::applySubmittedValues,
+                              ::Qt::QueuedConnection);
+}
+
+}  // namespace SideAssist::Qt
@@ -0,0 +1,59 @@
+#include <cmath>
+#include "client.hpp"
+
+namespace SideAssist::Qt {
+
+void Client::throttleValue(ValueKind kind, const NamedValue* value) {
+  const qint64 now = clock_.elapsed();
+  const auto interval = qint64(std::ceil(1000.0 / value->maxPublishRate()));
+  auto& throttle = throttles_[value];
+  throttle.kind = kind;
+  // The latest value is read when the deadline passes
+  if (throttle.pending)
+    return;
+  if (now - throttle.last_publish >= interval) {
+    throttle.last_publish = now;
+    if (kind == ValueKind::Option)
+      uploadOptionValue(value);
+    else
+      uploadParameterValue(value);
+    return;
+  }
+  throttle.pending = true;
+  throttle_deadlines_.emplace(throttle.last_publish + interval, value);
+  rescheduleThrottleTimer();
+}
+
+void Client::flushThrottledValues() {
+  const qint64 now = clock_.elapsed();
+  while (!throttle_deadlines_.empty() &&
+         throttle_deadlines_.top().first <= now) {
+    const NamedValue* value = throttle_deadlines_.top().second;
+    throttle_deadlines_.pop();
+    auto& throttle = throttles_[value];
+    if (!throttle.pending)
+      continue;
+    throttle.pending = false;
+    // Changes made while offline are resynced on the next connection
+    if (!acceptsPublishes())
+      continue;
+    throttle.last_publish = now;
+    if (throttle.kind == ValueKind::Option)
+      uploadOptionValue(value);
+    else
+      uploadParameterValue(value);
+  }
+  rescheduleThrottleTimer();
+}
+
+void Client::rescheduleThrottleTimer() {
+  if (throttle_deadlines_.empty()) {
+    throttle_timer_.stop();
+    return;
+  }
+  const qint64 delay =
+      throttle_deadlines_.top().first - clock_.elapsed();
+  throttle_timer_.start(int(qMax<qint64>(delay, 0)));
+}
+
+}  // namespace SideAssist::Qt
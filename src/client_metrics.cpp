@@ -0,0 +1,118 @@
+#include "client_metrics.hpp"
+#include <QJsonArray>
+#include <QtAlgorithms>
+
+namespace SideAssist::Qt {
+
+void LatencyHistogram::record(qint64 usec) {
+  auto value = quint64(qMax<qint64>(usec, 0));
+  // Number of significant bits, 0 for 0
+  int index = qMin(64 - int(qCountLeadingZeroBits(value)), bucket_count - 1);
+  buckets_[index].fetch_add(1, std::memory_order_relaxed);
+  count_.fetch_add(1, std::memory_order_relaxed);
+  sum_.fetch_add(value, std::memory_order_relaxed);
+  quint64 max = max_.load(std::memory_order_relaxed);
+  while (value > max &&
+         !max_.compare_exchange_weak(max, value, std::memory_order_relaxed)) {
+  }
+}
+
+quint64 LatencyHistogram::percentile(double p) const {
+  quint64 total = count();
+  if (total == 0)
+    return 0;
+  auto rank = quint64(p * double(total - 1)) + 1;
+  quint64 seen = 0;
+  for (int i = 0; i < bucket_count - 1; ++i) {
+    seen += bucket(i);
+    if (seen >= rank)
+      return quint64(1) << i;
+  }
+  return max();
+}
+
+void LatencyHistogram::reset() {
+  for (auto& bucket : buckets_)
+    bucket.store(0, std::memory_order_relaxed);
+  count_.store(0, std::memory_order_relaxed);
+  sum_.store(0, std::memory_order_relaxed);
+  max_.store(0, std::memory_order_relaxed);
+}
+
+QJsonObject LatencyHistogram::toJson() const {
+  // Trailing empty buckets are left out
+  int used = bucket_count;
+  while (used > 0 && bucket(used - 1) == 0)
+    --used;
+  QJsonArray buckets;
+  for (int i = 0; i < used; ++i)
+    buckets.append(qint64(bucket(i)));
+  return {{"count", qint64(count())},
+          {"sum_us", qint64(sum())},
+          {"max_us", qint64(max())},
+          {"p50_us", qint64(percentile(0.5))},
+          {"p99_us", qint64(percentile(0.99))},
+          {"log2_buckets", buckets}};
+}
+
+static const char* topicClassName(ClientMetrics::TopicClass topic_class) {
+  switch (topic_class) {
+    case ClientMetrics::TopicClass::OptionValue:
+      return "option";
+    case ClientMetrics::TopicClass::OptionSet:
+      return "option_set";
+    case ClientMetrics::TopicClass::OptionValidator:
+      return "option_validator";
+    case ClientMetrics::TopicClass::ParameterValue:
+      return "param";
+    case ClientMetrics::TopicClass::ParameterValidator:
+      return "param_validator";
+    case ClientMetrics::TopicClass::Control:
+      return "control";
+    case ClientMetrics::TopicClass::Unknown:
+      break;
+  }
+  return "unknown";
+}
+
+void ClientMetrics::reset() {
+  for (int i = 0; i < topic_class_count; ++i) {
+    received_[i].store(0, std::memory_order_relaxed);
+    published_[i].store(0, std::memory_order_relaxed);
+    oversized_[i].store(0, std::memory_order_relaxed);
+  }
+  bytes_in_.store(0, std::memory_order_relaxed);
+  bytes_out_.store(0, std::memory_order_relaxed);
+  parse_failures_.store(0, std::memory_order_relaxed);
+  validation_failures_.store(0, std::memory_order_relaxed);
+  compacted_sets_.store(0, std::memory_order_relaxed);
+  handle_message_time_.reset();
+  process_received_time_.reset();
+  publish_ack_latency_.reset();
+}
+
+QJsonObject ClientMetrics::toJson() const {
+  QJsonObject received, published, oversized;
+  for (int i = 0; i < topic_class_count; ++i) {
+    auto topic_class = TopicClass(i);
+    if (quint64 count = this->received(topic_class))
+      received.insert(topicClassName(topic_class), qint64(count));
+    if (quint64 count = this->published(topic_class))
+      published.insert(topicClassName(topic_class), qint64(count));
+    if (quint64 count = oversizedPayloads(topic_class))
+      oversized.insert(topicClassName(topic_class), qint64(count));
+  }
+  return {{"received", received},
+          {"published", published},
+          {"oversized_payloads", oversized},
+          {"bytes_in", qint64(bytesIn())},
+          {"bytes_out", qint64(bytesOut())},
+          {"parse_failures", qint64(parseFailures())},
+          {"validation_failures", qint64(validationFailures())},
+          {"compacted_sets", qint64(compactedSets())},
+          {"handle_message_time", handle_message_time_.toJson()},
+          {"process_received_time", process_received_time_.toJson()},
+          {"publish_ack_latency", publish_ack_latency_.toJson()}};
+}
+
+}  // namespace SideAssist::Qt
@@ -0,0 +1,107 @@
+#include "named_value_registry.hpp"
+#include <QHash>
+#include <QMutexLocker>
+
+namespace SideAssist::Qt {
+
+static constexpr size_t initial_capacity = 16;
+
+NamedValueRegistry::Table::Table(size_t capacity)
+    : mask(capacity - 1),
+      slots(std::make_unique<std::atomic<const Entry*>[]>(capacity)) {
+  for (size_t i = 0; i < capacity; ++i)
+    slots[i].store(nullptr, std::memory_order_relaxed);
+}
+
+NamedValueRegistry::NamedValueRegistry() {
+  tables_.push_back(std::make_unique<Table>(initial_capacity));
+  table_.store(tables_.back().get(), std::memory_order_release);
+}
+
+NamedValueRegistry::~NamedValueRegistry() = default;
+
+const std::shared_ptr<NamedValue>* NamedValueRegistry::find(
+    const QString& name) const {
+  const Table* table = table_.load(std::memory_order_acquire);
+  const size_t hash = qHash(name);
+  // The table is at most half full, so probing always hits an empty slot
+  for (size_t i = hash & table->mask;; i = (i + 1) & table->mask) {
+    const Entry* entry = table->slots[i].load(std::memory_order_acquire);
+    if (entry == nullptr)
+      return nullptr;
+    if (entry->hash == hash && entry->name == name)
+      return &entry->value;
+  }
+}
+
+std::pair<const std::shared_ptr<NamedValue>*, bool>
+NamedValueRegistry::emplace(const QString& name,
+                            std::shared_ptr<NamedValue> value) {
+  QMutexLocker lock(&write_mutex_);
+  return emplaceLocked(name, std::move(value));
+}
+
+std::vector<std::pair<const std::shared_ptr<NamedValue>*, bool> >
+NamedValueRegistry::emplace(
+    std::vector<std::pair<QString, std::shared_ptr<NamedValue> > > items) {
+  std::vector<std::pair<const std::shared_ptr<NamedValue>*, bool> > results;
+  results.reserve(items.size());
+  QMutexLocker lock(&write_mutex_);
+  // Grow once up front instead of doubling repeatedly
+  reserveLocked(entries_.size() + items.size());
+  for (auto& [name, value] : items)
+    results.push_back(emplaceLocked(name, std::move(value)));
+  return results;
+}
+
+void NamedValueRegistry::reserveLocked(size_t count) {
+  const Table* table = tables_.back().get();
+  size_t capacity = table->mask + 1;
+  while (count * 2 > capacity)
+    capacity *= 2;
+  if (capacity == table->mask + 1)
+    return;
+
+  auto grown = std::make_unique<Table>(capacity);
+  for (const auto& entry : entries_)
+    insertInto(*grown, entry.get());
+  tables_.push_back(std::move(grown));
+  // Readers still probing the old table see a consistent, older state
+  table_.store(tables_.back().get(), std::memory_order_release);
+}
+
+std::pair<const std::shared_ptr<NamedValue>*, bool>
+NamedValueRegistry::emplaceLocked(const QString& name,
+                                  std::shared_ptr<NamedValue> value) {
+  if (auto* existing = find(name))
+    return {existing, false};
+
+  reserveLocked(entries_.size() + 1);
+  entries_.push_back(
+      std::make_unique<Entry>(Entry{name, qHash(name), std::move(value)}));
+  insertInto(*tables_.back(), entries_.back().get());
+  return {&entries_.back()->value, true};
+}
+
+std::vector<std::shared_ptr<NamedValue> > NamedValueRegistry::values() const {
+  QMutexLocker lock(&write_mutex_);
+  std::vector<std::shared_ptr<NamedValue> > values;
+  values.reserve(entries_.size());
+  for (const auto& entry : entries_)
+    values.push_back(entry->value);
+  return values;
+}
+
+size_t NamedValueRegistry::size() const {
+  QMutexLocker lock(&write_mutex_);
+  return entries_.size();
+}
+
+void NamedValueRegistry::insertInto(Table& table, const Entry* entry) {
+  size_t i = entry->hash & table.mask;
+  while (table.slots[i].load(std::memory_order_relaxed) != nullptr)
+    i = (i + 1) & table.mask;
+  table.slots[i].store(entry, std::memory_order_release);
+}
+
+}  // namespace SideAssist::Qt
@@ -0,0 +1,518 @@
+#include "payload.hpp"
+#include <QCborMap>
+#include <QCborStreamWriter>
+#include <QCborValue>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QRegularExpression>
+#include <charconv>
+#include <cstring>
+#include <zlib.h>
+
+namespace SideAssist::Qt::Payload {
+
+static void appendJsonString(const QString& str, QByteArray& buf) {
+  static const char hex[] = "0123456789abcdef";
+  buf.append('"');
+  const QChar* p = str.constData();
+  const QChar* end = p + str.size();
+  for (; p != end; ++p) {
+    char32_t c = p->unicode();
+    if (p->isHighSurrogate() && p + 1 != end && (p + 1)->isLowSurrogate()) {
+      c = QChar::surrogateToUcs4(p->unicode(), (p + 1)->unicode());
+      ++p;
+    } else if (p->isSurrogate()) {
+      c = QChar::ReplacementCharacter;
+    }
+
+    if (c < 0x80) {
+      switch (c) {
+        case '"':
+          buf.append("\\\"", 2);
+          break;
+        case '\\':
+          buf.append("\\\\", 2);
+          break;
+        case '\b':
+          buf.append("\\b", 2);
+          break;
+        case '\f':
+          buf.append("\\f", 2);
+          break;
+        case '\n':
+          buf.append("\\n", 2);
+          break;
+        case '\r':
+          buf.append("\\r", 2);
+          break;
+        case '\t':
+          buf.append("\\t", 2);
+          break;
+        default:
+          if (c < 0x20) {
+            const char esc[] = {'\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xf]};
+            buf.append(esc, sizeof(esc));
+          } else {
+            buf.append(char(c));
+          }
+      }
+    } else if (c < 0x800) {
+      const char seq[] = {char(0xc0 | (c >> 6)), char(0x80 | (c & 0x3f))};
+      buf.append(seq, sizeof(seq));
+    } else if (c < 0x10000) {
+      const char seq[] = {char(0xe0 | (c >> 12)),
+                          char(0x80 | ((c >> 6) & 0x3f)),
+                          char(0x80 | (c & 0x3f))};
+      buf.append(seq, sizeof(seq));
+    } else {
+      const char seq[] = {char(0xf0 | (c >> 18)),
+                          char(0x80 | ((c >> 12) & 0x3f)),
+                          char(0x80 | ((c >> 6) & 0x3f)),
+                          char(0x80 | (c & 0x3f))};
+      buf.append(seq, sizeof(seq));
+    }
+  }
+  buf.append('"');
+}
+
+static void appendJsonNumber(const QJsonValue& value, QByteArray& buf) {
+  char chars[32];
+  std::to_chars_result res;
+  const double d = value.toDouble();
+  // toInteger() is exact for integers beyond 2^53 as well
+  const qint64 i = value.toInteger(0);
+  if (i != 0 || d == 0)
+    res = std::to_chars(chars, chars + sizeof(chars), i);
+  else if (qIsFinite(d))
+    res = std::to_chars(chars, chars + sizeof(chars), d);
+  else {
+    // Same as QJsonDocument
+    buf.append("null", 4);
+    return;
+  }
+  buf.append(chars, res.ptr - chars);
+}
+
+static constexpr char cbor_signature[] = {'\xd9', '\xd9', '\xf7'};
+static constexpr char compressed_signature[] = {'\0', 'S', 'A', 'Z'};
+
+static void writeCborValue(const QJsonValue& value, QCborStreamWriter& writer) {
+  switch (value.type()) {
+    case QJsonValue::Null:
+      writer.append(nullptr);
+      break;
+    case QJsonValue::Bool:
+      writer.append(value.toBool());
+      break;
+    case QJsonValue::Double: {
+      const double d = value.toDouble();
+      const qint64 i = value.toInteger(0);
+      if (i != 0 || d == 0)
+        writer.append(i);
+      else
+        writer.append(d);
+      break;
+    }
+    case QJsonValue::String:
+      writer.append(value.toString());
+      break;
+    default:
+      QCborValue::fromJsonValue(value).toCbor(writer);
+      break;
+  }
+}
+
+void writeValue(const QJsonValue& value, QByteArray& buf, Encoding encoding) {
+  buf.resize(0);
+  if (encoding == Encoding::Cbor) {
+    QCborStreamWriter writer(&buf);
+    writer.append(QCborKnownTags::Signature);
+    writer.startMap(1);
+    writer.append(QLatin1String("value"));
+    writeCborValue(value, writer);
+    writer.endMap();
+    return;
+  }
+
+  buf.append("{\"value\":", 9);
+  switch (value.type()) {
+    case QJsonValue::Bool:
+      if (value.toBool())
+        buf.append("true", 4);
+      else
+        buf.append("false", 5);
+      break;
+    case QJsonValue::Double:
+      appendJsonNumber(value, buf);
+      break;
+    case QJsonValue::String:
+      appendJsonString(value.toString(), buf);
+      break;
+    case QJsonValue::Array:
+      buf.append(QJsonDocument(value.toArray()).toJson(QJsonDocument::Compact));
+      break;
+    case QJsonValue::Object:
+      buf.append(
+          QJsonDocument(value.toObject()).toJson(QJsonDocument::Compact));
+      break;
+    default:
+      buf.append("null", 4);
+      break;
+  }
+  buf.append('}');
+}
+
+QByteArray writeValidator(const QJsonValue& validator, Encoding encoding) {
+  if (encoding == Encoding::Cbor) {
+    QCborMap map;
+    map.insert(QLatin1String("validator"), QCborValue::fromJsonValue(validator));
+    return QCborValue(QCborKnownTags::Signature, map).toCbor();
+  }
+  return QJsonDocument(QJsonObject({qMakePair("validator", validator)}))
+      .toJson(QJsonDocument::Compact);
+}
+
+Encoding detectEncoding(const QByteArray& payload) {
+  return payload.startsWith(QByteArrayView(cbor_signature,
+                                           sizeof(cbor_signature)))
+             ? Encoding::Cbor
+             : Encoding::Json;
+}
+
+bool isCompressed(const QByteArray& payload) {
+  return payload.startsWith(
+      QByteArrayView(compressed_signature, sizeof(compressed_signature)));
+}
+
+QByteArray compress(const QByteArray& payload) {
+  return QByteArray(compressed_signature, sizeof(compressed_signature)) +
+         qCompress(payload);
+}
+
+bool decompress(const QByteArray& payload,
+                QByteArray& out,
+                qsizetype max_size,
+                QString* error) {
+  auto data = QByteArrayView(payload).sliced(sizeof(compressed_signature));
+  // qCompress() prepends the uncompressed size as a big-endian quint32
+  if (data.size() < 4) {
+    if (error != nullptr)
+      *error = "Truncated compressed payload";
+    return false;
+  }
+  const auto* header = reinterpret_cast<const uchar*>(data.data());
+  const qsizetype size = (qsizetype(header[0]) << 24) |
+                         (qsizetype(header[1]) << 16) |
+                         (qsizetype(header[2]) << 8) | qsizetype(header[3]);
+  if (size > max_size) {
+    if (error != nullptr)
+      *error = QString("Decompressed size %1 exceeds %2")
+                   .arg(size)
+                   .arg(max_size);
+    return false;
+  }
+
+  // The sender controls the header, so inflate in chunks and give up as
+  // soon as the output would pass max_size
+  z_stream stream{};
+  if (inflateInit(&stream) != Z_OK) {
+    if (error != nullptr)
+      *error = "Failed to initialize zlib";
+    return false;
+  }
+  stream.next_in =
+      reinterpret_cast<Bytef*>(const_cast<char*>(data.data())) + 4;
+  stream.avail_in = uInt(data.size() - 4);
+  out.clear();
+  out.reserve(size);
+  char chunk[16 * 1024];
+  int ret;
+  QString failure;
+  do {
+    stream.next_out = reinterpret_cast<Bytef*>(chunk);
+    stream.avail_out = sizeof(chunk);
+    ret = inflate(&stream, Z_NO_FLUSH);
+    if (ret != Z_OK && ret != Z_STREAM_END) {
+      failure = "Corrupted compressed payload";
+      break;
+    }
+    const qsizetype produced = qsizetype(sizeof(chunk) - stream.avail_out);
+    if (out.size() + produced > max_size) {
+      failure = QString("Decompressed size exceeds %1").arg(max_size);
+      break;
+    }
+    out.append(chunk, produced);
+  } while (ret != Z_STREAM_END);
+  inflateEnd(&stream);
+
+  if (failure.isEmpty() && out.size() != size)
+    failure = "Decompressed size does not match the header";
+  if (!failure.isEmpty()) {
+    out.clear();
+    if (error != nullptr)
+      *error = failure;
+    return false;
+  }
+  return true;
+}
+
+bool readValue(const QByteArray& payload,
+               QJsonValue& value,
+               QString* error,
+               qsizetype max_decompressed_size) {
+  if (isCompressed(payload)) {
+    QByteArray decompressed;
+    if (!decompress(payload, decompressed, max_decompressed_size, error))
+      return false;
+    if (isCompressed(decompressed)) {
+      if (error != nullptr)
+        *error = "Nested compressed payload";
+      return false;
+    }
+    return readValue(decompressed, value, error, max_decompressed_size);
+  }
+
+  if (detectEncoding(payload) == Encoding::Cbor) {
+    QCborParserError parse_error;
+    QCborValue cbor = QCborValue::fromCbor(payload, &parse_error);
+    if (parse_error.error != QCborError::NoError) {
+      if (error != nullptr)
+        *error = parse_error.errorString();
+      return false;
+    }
+    if (cbor.isTag())
+      cbor = cbor.taggedValue();
+    if (!cbor.isMap()) {
+      if (error != nullptr)
+        *error = "Payload is not a map";
+      return false;
+    }
+    value = cbor.toMap().value(QLatin1String("value")).toJsonValue();
+    return true;
+  }
+
+  if (readScalarValue(payload, value))
+    return true;
+
+  QJsonParseError parse_error;
+  QJsonDocument doc = QJsonDocument::fromJson(payload, &parse_error);
+  if (parse_error.error != QJsonParseError::NoError) {
+    if (error != nullptr)
+      *error = parse_error.errorString();
+    return false;
+  }
+  value = doc["value"];
+  return true;
+}
+
+namespace {
+
+class ScalarReader {
+ public:
+  ScalarReader(const char* begin, const char* end) : p_(begin), end_(end) {}
+
+  bool atEnd() {
+    skipSpaces();
+    return p_ == end_;
+  }
+
+  bool consume(char c) {
+    skipSpaces();
+    if (p_ == end_ || *p_ != c)
+      return false;
+    ++p_;
+    return true;
+  }
+
+  bool consume(const char* literal, size_t size) {
+    if (size_t(end_ - p_) < size || std::memcmp(p_, literal, size) != 0)
+      return false;
+    p_ += size;
+    return true;
+  }
+
+  bool readScalar(QJsonValue& value) {
+    skipSpaces();
+    if (p_ == end_)
+      return false;
+    switch (*p_) {
+      case 't':
+        value = true;
+        return consume("true", 4);
+      case 'f':
+        value = false;
+        return consume("false", 5);
+      case 'n':
+        value = QJsonValue(QJsonValue::Null);
+        return consume("null", 4);
+      case '"': {
+        QString str;
+        if (!readString(str))
+          return false;
+        value = str;
+        return true;
+      }
+      default:
+        return readNumber(value);
+    }
+  }
+
+  // ASCII only, the DOM parser checks UTF-8 and \u escapes
+  bool readString(QString& str) {
+    ++p_;  // "
+    const char* begin = p_;
+    bool escaped = false;
+    for (; p_ != end_ && *p_ != '"'; ++p_) {
+      auto c = uchar(*p_);
+      if (c < 0x20 || c >= 0x80)
+        return false;
+      if (c == '\\') {
+        escaped = true;
+        if (++p_ == end_)
+          return false;
+      }
+    }
+    if (p_ == end_)
+      return false;
+    const char* end = p_++;
+    if (!escaped) {
+      str = QString::fromLatin1(begin, end - begin);
+      return true;
+    }
+    str.reserve(end - begin);
+    for (const char* q = begin; q != end; ++q) {
+      if (*q != '\\') {
+        str.append(QLatin1Char(*q));
+        continue;
+      }
+      switch (*++q) {
+        case '"':
+        case '\\':
+        case '/':
+          str.append(QLatin1Char(*q));
+          break;
+        case 'b':
+          str.append(QLatin1Char('\b'));
+          break;
+        case 'f':
+          str.append(QLatin1Char('\f'));
+          break;
+        case 'n':
+          str.append(QLatin1Char('\n'));
+          break;
+        case 'r':
+          str.append(QLatin1Char('\r'));
+          break;
+        case 't':
+          str.append(QLatin1Char('\t'));
+          break;
+        default:
+          return false;
+      }
+    }
+    return true;
+  }
+
+  // -?(0|[1-9][0-9]*)(.[0-9]+)?([eE][+-]?[0-9]+)?
+  bool readNumber(QJsonValue& value) {
+    const char* begin = p_;
+    if (p_ != end_ && *p_ == '-')
+      ++p_;
+    if (p_ == end_ || !isDigit(*p_))
+      return false;
+    if (*p_ == '0')
+      ++p_;
+    else
+      skipDigits();
+    bool integer = true;
+    if (p_ != end_ && *p_ == '.') {
+      integer = false;
+      ++p_;
+      if (p_ == end_ || !isDigit(*p_))
+        return false;
+      skipDigits();
+    }
+    if (p_ != end_ && (*p_ == 'e' || *p_ == 'E')) {
+      integer = false;
+      ++p_;
+      if (p_ != end_ && (*p_ == '+' || *p_ == '-'))
+        ++p_;
+      if (p_ == end_ || !isDigit(*p_))
+        return false;
+      skipDigits();
+    }
+
+    // Like QJsonDocument: integers are exact when they fit in 64 bits
+    if (integer) {
+      qint64 i;
+      auto res = std::from_chars(begin, p_, i);
+      if (res.ec == std::errc() && res.ptr == p_) {
+        value = i;
+        return true;
+      }
+    }
+    double d;
+    auto res = std::from_chars(begin, p_, d);
+    if (res.ec != std::errc() || res.ptr != p_ || !qIsFinite(d))
+      return false;
+    value = d;
+    return true;
+  }
+
+ private:
+  static bool isDigit(char c) { return c >= '0' && c <= '9'; }
+
+  void skipDigits() {
+    while (p_ != end_ && isDigit(*p_))
+      ++p_;
+  }
+
+  void skipSpaces() {
+    while (p_ != end_ &&
+           (*p_ == ' ' || *p_ == '\t' || *p_ == '\n' || *p_ == '\r'))
+      ++p_;
+  }
+
+  const char* p_;
+  const char* end_;
+};
+
+}  // namespace
+
+bool readScalarValue(const QByteArray& payload, QJsonValue& value) {
+  ScalarReader reader(payload.constData(),
+                      payload.constData() + payload.size());
+  QJsonValue scalar;
+  if (!reader.consume('{') || !reader.consume('"') ||
+      !reader.consume("value\"", 6) || !reader.consume(':') ||
+      !reader.readScalar(scalar) || !reader.consume('}') || !reader.atEnd())
+    return false;
+  value = std::move(scalar);
+  return true;
+}
+
+QString toDisplayString(const QByteArray& payload) {
+  // Never inflated: a log line must not cost more than the size limit
+  // allowed through, or anything at all for a payload it rejected
+  if (isCompressed(payload))
+    return QString("<%1 bytes compressed>").arg(payload.size());
+
+  // Only the start is shown, no need to parse or scan a huge payload
+  const QByteArray head = payload.left(1024);
+  QString str;
+  if (detectEncoding(payload) == Encoding::Cbor) {
+    // A cut off payload yields the items before the cut
+    str = QCborValue::fromCbor(head).toDiagnosticNotation(QCborValue::Compact);
+    if (head.size() < payload.size())
+      str += "...";
+  } else {
+    static const QRegularExpression spaces("[ \t\n][ \t\n]+");
+    str = QString::fromUtf8(head).replace(spaces, " ");
+  }
+  if (str.length() > 256)
+    str = str.left(253) + "...";
+  return str;
+}
+
+}  // namespace SideAssist::Qt::Payload
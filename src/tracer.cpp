@@ -0,0 +1,160 @@
+#include "tracer.hpp"
+#include <QCoreApplication>
+#include <QFile>
+#include <QMutex>
+#include <chrono>
+#include <memory>
+#include <vector>
+
+namespace SideAssist::Qt {
+
+std::atomic<bool> Tracer::enabled_{false};
+
+namespace {
+
+struct Event {
+  const char* name;
+  qint64 begin_ns;
+  qint64 end_ns;
+};
+
+// Written by its thread only. count is published with release order after
+// the event is stored, so readers see complete events up to count.
+struct ThreadBuffer {
+  ThreadBuffer(size_t capacity, int tid)
+      : events(std::make_unique<Event[]>(capacity)),
+        capacity(capacity),
+        tid(tid) {}
+
+  std::unique_ptr<Event[]> events;
+  const size_t capacity;
+  const int tid;
+  std::atomic<size_t> count{0};
+  std::atomic<quint64> dropped{0};
+};
+
+struct Registry {
+  QMutex mutex;
+  // Buffers outlive their threads, they are only read at export
+  std::vector<std::unique_ptr<ThreadBuffer> > buffers;
+  size_t capacity = 65536;
+};
+
+Registry& registry() {
+  static Registry instance;
+  return instance;
+}
+
+ThreadBuffer* threadBuffer() {
+  thread_local ThreadBuffer* buffer = nullptr;
+  if (buffer == nullptr) {
+    auto& reg = registry();
+    QMutexLocker lock(&reg.mutex);
+    reg.buffers.push_back(std::make_unique<ThreadBuffer>(
+        reg.capacity, int(reg.buffers.size()) + 1));
+    buffer = reg.buffers.back().get();
+  }
+  return buffer;
+}
+
+void appendJsonString(QByteArray& out, const char* str) {
+  out.append('"');
+  for (; *str; ++str) {
+    if (*str == '"' || *str == '\\')
+      out.append('\\');
+    out.append(*str);
+  }
+  out.append('"');
+}
+
+}  // namespace
+
+void Tracer::setEnabled(bool enabled) {
+  enabled_.store(enabled, std::memory_order_relaxed);
+}
+
+void Tracer::setBufferCapacity(size_t events) {
+  auto& reg = registry();
+  QMutexLocker lock(&reg.mutex);
+  reg.capacity = qMax<size_t>(events, 1);
+}
+
+qint64 Tracer::now() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+void Tracer::record(const char* name, qint64 begin_ns, qint64 end_ns) {
+  ThreadBuffer* buffer = threadBuffer();
+  size_t index = buffer->count.load(std::memory_order_relaxed);
+  if (index >= buffer->capacity) {
+    buffer->dropped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  buffer->events[index] = {name, begin_ns, end_ns};
+  buffer->count.store(index + 1, std::memory_order_release);
+}
+
+QByteArray Tracer::toChromeTraceJson() {
+  auto& reg = registry();
+  QMutexLocker lock(&reg.mutex);
+  const QByteArray pid = QByteArray::number(QCoreApplication::applicationPid());
+
+  QByteArray out;
+  out.append("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+  bool first = true;
+  for (const auto& buffer : reg.buffers) {
+    size_t count = buffer->count.load(std::memory_order_acquire);
+    const QByteArray tid = QByteArray::number(buffer->tid);
+    for (size_t i = 0; i < count; ++i) {
+      const Event& event = buffer->events[i];
+      if (!first)
+        out.append(',');
+      first = false;
+      // Complete events, timestamps in microseconds
+      out.append("{\"ph\":\"X\",\"cat\":\"side_assist\",\"name\":");
+      appendJsonString(out, event.name);
+      out.append(",\"ts\":");
+      out.append(QByteArray::number(double(event.begin_ns) / 1000.0, 'f', 3));
+      out.append(",\"dur\":");
+      out.append(QByteArray::number(
+          double(event.end_ns - event.begin_ns) / 1000.0, 'f', 3));
+      out.append(",\"pid\":").append(pid);
+      out.append(",\"tid\":").append(tid);
+      out.append('}');
+    }
+  }
+  out.append("]}");
+  return out;
+}
+
+bool Tracer::writeChromeTrace(const QString& path) {
+  QFile file(path);
+  if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+    qCritical("Could not open trace file %s: %s", qUtf8Printable(path),
+              qUtf8Printable(file.errorString()));
+    return false;
+  }
+  return file.write(toChromeTraceJson()) >= 0;
+}
+
+quint64 Tracer::droppedEvents() {
+  auto& reg = registry();
+  QMutexLocker lock(&reg.mutex);
+  quint64 dropped = 0;
+  for (const auto& buffer : reg.buffers)
+    dropped += buffer->dropped.load(std::memory_order_relaxed);
+  return dropped;
+}
+
+void Tracer::clear() {
+  auto& reg = registry();
+  QMutexLocker lock(&reg.mutex);
+  for (const auto& buffer : reg.buffers) {
+    buffer->count.store(0, std::memory_order_relaxed);
+    buffer->dropped.store(0, std::memory_order_relaxed);
+  }
+}
+
+}  // namespace SideAssist::Qt
@@ -0,0 +1,202 @@
+#include "validator_program.hpp"
+#include <iterator>
+#include "value_validator.hpp"
+
+namespace SideAssist::Qt::ValueValidator {
+
+namespace {
+
+// Indexed by QJsonValue::Type, Undefined is out of range
+constexpr quint32 type_bits[] = {
+    quint32(ValueTypeFieldEnum::Null),   quint32(ValueTypeFieldEnum::Bool),
+    quint32(ValueTypeFieldEnum::Double), quint32(ValueTypeFieldEnum::String),
+    quint32(ValueTypeFieldEnum::Array),  quint32(ValueTypeFieldEnum::Object),
+};
+static_assert(QJsonValue::Null == 0 && QJsonValue::Object == 5);
+
+bool matchesTypes(const QJsonValue& value, quint32 mask) noexcept {
+  const auto type = value.type();
+  if (uint(type) >= std::size(type_bits))
+    return false;
+  if (type_bits[type] & mask)
+    return true;
+  // Same test as Types::validate()
+  return type == QJsonValue::Double &&
+         (mask & quint32(ValueTypeFieldEnum::Integer)) &&
+         (value.toInteger(-1) != -1 || value.toInteger(0) != 0);
+}
+
+}  // namespace
+
+bool Program::run(const QJsonValue& value, quint32 pc) const noexcept {
+  bool result = false;
+  for (;;) {
+    const Instruction& instruction = code_[pc++];
+    switch (instruction.op) {
+      case Opcode::Accept:
+        result = true;
+        break;
+      case Opcode::Reject:
+        result = false;
+        break;
+      case Opcode::TypeMask:
+        result = matchesTypes(value, instruction.operand);
+        break;
+      case Opcode::Option: {
+        const auto& options = *string_sets_[instruction.operand];
+        result = value.isString() &&
+                 options.find(value.toString()) != options.end();
+        break;
+      }
+      case Opcode::Prefix:
+        result = false;
+        if (value.isString()) {
+          const QString str = value.toString();
+          for (const auto& prefix : *string_sets_[instruction.operand]) {
+            if (str.startsWith(prefix)) {
+              result = true;
+              break;
+            }
+          }
+        }
+        break;
+      case Opcode::Suffix:
+        result = false;
+        if (value.isString()) {
+          const QString str = value.toString();
+          for (const auto& suffix : *string_sets_[instruction.operand]) {
+            if (str.endsWith(suffix)) {
+              result = true;
+              break;
+            }
+          }
+        }
+        break;
+      case Opcode::Call:
+        result = calls_[instruction.operand]->validate(value);
+        break;
+      case Opcode::JumpIfFalse:
+        if (!result)
+          pc = instruction.operand;
+        break;
+      case Opcode::JumpIfTrue:
+        if (result)
+          pc = instruction.operand;
+        break;
+      case Opcode::EachItem:
+        result = value.isArray() && runEachItem(value.toArray(), pc);
+        pc = instruction.operand;
+        break;
+      case Opcode::Return:
+        return result;
+    }
+  }
+}
+
+bool Program::runEachItem(const QJsonArray& array,
+                          quint32 pc) const noexcept {
+  for (const auto& item : array) {
+    if (!run(item, pc))
+      return false;
+  }
+  return true;
+}
+
+Program ProgramBuilder::build(const Abstract& root) {
+  ProgramBuilder builder;
+  builder.compile(root);
+  builder.emit(Opcode::Return);
+  builder.program_.code_.shrink_to_fit();
+  return std::move(builder.program_);
+}
+
+void ProgramBuilder::compile(const Abstract& validator) {
+  validator.compile(*this);
+}
+
+void ProgramBuilder::emit(Opcode op, quint32 operand) {
+  program_.code_.push_back({op, operand});
+}
+
+void ProgramBuilder::emitAccept() {
+  emit(Opcode::Accept);
+}
+
+void ProgramBuilder::emitReject() {
+  emit(Opcode::Reject);
+}
+
+void ProgramBuilder::emitTypeMask(quint32 mask) {
+  emit(Opcode::TypeMask, mask);
+}
+
+void ProgramBuilder::emitOption(const std::set<QString>& options) {
+  emit(Opcode::Option, quint32(program_.string_sets_.size()));
+  program_.string_sets_.push_back(&options);
+}
+
+void ProgramBuilder::emitPrefix(const std::set<QString>& prefixes) {
+  emit(Opcode::Prefix, quint32(program_.string_sets_.size()));
+  program_.string_sets_.push_back(&prefixes);
+}
+
+void ProgramBuilder::emitSuffix(const std::set<QString>& suffixes) {
+  emit(Opcode::Suffix, quint32(program_.string_sets_.size()));
+  program_.string_sets_.push_back(&suffixes);
+}
+
+void ProgramBuilder::emitCall(const Abstract& validator) {
+  emit(Opcode::Call, quint32(program_.calls_.size()));
+  program_.calls_.push_back(&validator);
+}
+
+void ProgramBuilder::emitAny(const AbstractArray& validators) {
+  emitBranches(validators, Opcode::JumpIfTrue, Opcode::Reject);
+}
+
+void ProgramBuilder::emitAll(const AbstractArray& validators) {
+  emitBranches(validators, Opcode::JumpIfFalse, Opcode::Accept);
+}
+
+void ProgramBuilder::emitBranches(const AbstractArray& validators,
+                                  Opcode jump,
+                                  Opcode empty) {
+  auto& code = program_.code_;
+  std::vector<quint32> exits;
+  // The previous branch if it was a lone type mask
+  qsizetype mask = -1;
+  for (const auto& validator : validators) {
+    const quint32 start = pc();
+    compile(*validator);
+    const bool lone_mask =
+        pc() == start + 1 && code[start].op == Opcode::TypeMask;
+    if (jump == Opcode::JumpIfTrue && lone_mask && mask >= 0) {
+      // Either of two type masks is their union
+      code[mask].operand |= code[start].operand;
+      code.pop_back();
+      continue;
+    }
+    mask = lone_mask ? qsizetype(start) : -1;
+    exits.push_back(pc());
+    emit(jump);
+  }
+  if (exits.empty()) {
+    emit(empty);
+    return;
+  }
+  // The last branch falls through to the end anyway
+  code.pop_back();
+  exits.pop_back();
+  for (quint32 exit : exits)
+    code[exit].operand = pc();
+}
+
+void ProgramBuilder::emitEachItem(const Abstract& item_validator) {
+  const quint32 each = pc();
+  emit(Opcode::EachItem);
+  compile(item_validator);
+  emit(Opcode::Return);
+  program_.code_[each].operand = pc();
+}
+
+}  // namespace SideAssist::Qt::ValueValidator
@@ -1,14 +1,81 @@
 #include "value_validator.hpp"
+#include <QCryptographicHash>
 #include <QJsonArray>
 #include <QJsonDocument>
 #include <QJsonObject>
 
 namespace SideAssist::Qt::ValueValidator {
 
+struct Abstract::SerializedCache {
+  QByteArray json_payload;
+  QByteArray cbor_payload;
+  QByteArray digest;
+};
+
+Abstract::~Abstract() {
+  delete serialized_cache_.load(std::memory_order_relaxed);
+  delete program_.load(std::memory_order_relaxed);
+}
+
+const Abstract::SerializedCache& Abstract::serializedCache() const {
+  auto* cache = serialized_cache_.load(std::memory_order_acquire);
+  if (cache != nullptr)
+    return *cache;
+
+  auto json = serializeToJson();
+  auto json_payload = Payload::writeValidator(json, Payload::Encoding::Json);
+  auto cbor_payload = Payload::writeValidator(json, Payload::Encoding::Cbor);
+  auto digest =
+      QCryptographicHash::hash(json_payload, QCryptographicHash::Sha1);
+  auto* fresh = new SerializedCache{std::move(json_payload),
+                                    std::move(cbor_payload), std::move(digest)};
+
+  // Another thread may have won the race, keep its result
+  if (serialized_cache_.compare_exchange_strong(cache, fresh,
+                                                std::memory_order_acq_rel,
+                                                std::memory_order_acquire))
+    return *fresh;
+  delete fresh;
+  return *cache;
+}
+
+const QByteArray& Abstract::serializedPayload(
+    Payload::Encoding encoding) const {
+  const auto& cache = serializedCache();
+  return encoding == Payload::Encoding::Cbor ? cache.cbor_payload
+                                             : cache.json_payload;
+}
+
+const QByteArray& Abstract::digest() const {
+  return serializedCache().digest;
+}
+
+const Program& Abstract::program() const {
+  auto* program = program_.load(std::memory_order_acquire);
+  if (program != nullptr)
+    return *program;
+
+  auto* fresh = new Program(ProgramBuilder::build(*this));
+  if (program_.compare_exchange_strong(program, fresh,
+                                       std::memory_order_acq_rel,
+                                       std::memory_order_acquire))
+    return *fresh;
+  delete fresh;
+  return *program;
+}
+
+void Abstract::compile(ProgramBuilder& builder) const {
+  builder.emitCall(*this);
+}
+
 bool Dummy::validate(const QJsonValue& value) const noexcept {
   return true;
 }
 
+void Dummy::compile(ProgramBuilder& builder) const {
+  builder.emitAccept();
+}
+
 QJsonValue Dummy::serializeToJson() const noexcept {
   return QJsonObject({qMakePair("dummy", QJsonValue(QJsonValue::Null))});
 }
@@ -50,6 +117,9 @@ Abstract::deserializeFromJson(const QJsonValue& validator) {
   if (matched)
     return ptr;
   ptr = All::deserializeFromJson(validator, &matched);
+  if (matched)
+    return ptr;
+  ptr = ListItem::deserializeFromJson(validator, &matched);
   if (matched)
     return ptr;
   return nullptr;
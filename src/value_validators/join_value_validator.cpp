@@ -13,6 +13,10 @@ bool All::validate(const QJsonValue& value) const noexcept {
   return true;
 }
 
+void All::compile(ProgramBuilder& builder) const {
+  builder.emitAll(*this);
+}
+
 QJsonValue All::serializeToJson() const noexcept {
   QJsonArray arr;
   for (const auto& ptr : *this) {
@@ -14,6 +14,10 @@ bool ListItem::validate(const QJsonValue& value) const noexcept {
   return true;
 }
 
+void ListItem::compile(ProgramBuilder& builder) const {
+  builder.emitEachItem(*item_validator_);
+}
+
 QJsonValue ListItem::serializeToJson() const noexcept {
   return QJsonObject({qMakePair("list", item_validator_->serializeToJson())});
 }
@@ -9,6 +9,10 @@ bool Option::validate(const QJsonValue& value) const noexcept {
   return value.isString() && options_.find(value.toString()) != options_.end();
 }
 
+void Option::compile(ProgramBuilder& builder) const {
+  builder.emitOption(options_);
+}
+
 QJsonValue Option::serializeToJson() const noexcept {
   QJsonArray arr;
   for (const auto& str : options_)
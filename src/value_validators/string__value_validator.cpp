@@ -17,6 +17,10 @@ bool StringPrefix::validate(
   return false;
 }
 
+void StringPrefix::compile(ProgramBuilder& builder) const {
+  builder.emitPrefix(prefixes_);
+}
+
 QJsonValue StringPrefix::serializeToJson() const noexcept {
   return QJsonObject({qMakePair("prefix", QJsonValue(QJsonValue::Null))});
 }
@@ -60,6 +64,10 @@ bool StringSuffix::validate(
   return false;
 }
 
+void StringSuffix::compile(ProgramBuilder& builder) const {
+  builder.emitSuffix(suffixes_);
+}
+
 QJsonValue StringSuffix::serializeToJson() const noexcept {
   return QJsonObject({qMakePair("suffix", QJsonValue(QJsonValue::Null))});
 }
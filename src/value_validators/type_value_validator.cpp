@@ -12,6 +12,13 @@ bool SingleType::validate(
   return typeToField(value.type()) == type_;
 }
 
+void SingleType::compile(ProgramBuilder& builder) const {
+  if (type_ == ValueTypeFieldEnum::Undefined)
+    builder.emitCall(*this);
+  else
+    builder.emitTypeMask(type_);
+}
+
 QJsonValue SingleType::serializeToJson() const noexcept {
   QString name;
   switch (type_.value) {
@@ -91,6 +98,10 @@ bool Types::validate(const QJsonValue& value) const noexcept {
   return false;
 }
 
+void Types::compile(ProgramBuilder& builder) const {
+  builder.emitTypeMask(type_field_);
+}
+
 QJsonValue Types::serializeToJson() const noexcept {
   QJsonArray arr;
   if (type_field_ & ValueTypeFieldEnum::Null)
@@ -13,6 +13,10 @@ bool Any::validate(const QJsonValue& value) const noexcept {
   return false;
 }
 
+void Any::compile(ProgramBuilder& builder) const {
+  builder.emitAny(*this);
+}
+
 QJsonValue Any::serializeToJson() const noexcept {
   QJsonArray arr;
   for (const auto& ptr : *this) {
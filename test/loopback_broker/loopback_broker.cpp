@@ -0,0 +1,402 @@
+#include "loopback_broker.hpp"
+#include <QHostAddress>
+#include <QStringList>
+#include <QTcpSocket>
+
+namespace SideAssist::Qt::Testing {
+
+namespace {
+
+enum PacketType : quint8 {
+  Connect = 1,
+  Connack = 2,
+  Publish = 3,
+  Puback = 4,
+  Pubrec = 5,
+  Pubrel = 6,
+  Pubcomp = 7,
+  Subscribe = 8,
+  Suback = 9,
+  Unsubscribe = 10,
+  Unsuback = 11,
+  Pingreq = 12,
+  Pingresp = 13,
+  Disconnect = 14,
+};
+
+// Big-endian fields of a packet body, failing softly past the end
+class Reader {
+ public:
+  explicit Reader(const QByteArray& data) : data_(data) {}
+
+  bool atEnd() const { return pos_ >= data_.size(); }
+  bool ok() const { return ok_; }
+
+  quint8 byte() {
+    if (pos_ + 1 > data_.size())
+      return fail();
+    return quint8(data_[pos_++]);
+  }
+  quint16 u16() {
+    quint16 high = byte();
+    return quint16((high << 8) | byte());
+  }
+  QByteArray bytes(qsizetype size) {
+    if (pos_ + size > data_.size()) {
+      fail();
+      return {};
+    }
+    QByteArray out = data_.mid(pos_, size);
+    pos_ += size;
+    return out;
+  }
+  QByteArray string() { return bytes(u16()); }
+  QByteArray rest() { return bytes(data_.size() - pos_); }
+
+ private:
+  quint8 fail() {
+    ok_ = false;
+    pos_ = data_.size();
+    return 0;
+  }
+
+  const QByteArray& data_;
+  qsizetype pos_ = 0;
+  bool ok_ = true;
+};
+
+void appendU16(QByteArray& out, quint16 value) {
+  out.append(char(value >> 8));
+  out.append(char(value & 0xff));
+}
+
+void appendString(QByteArray& out, const QByteArray& str) {
+  appendU16(out, quint16(str.size()));
+  out.append(str);
+}
+
+QByteArray packetId(quint16 id) {
+  QByteArray body;
+  appendU16(body, id);
+  return body;
+}
+
+}  // namespace
+
+LoopbackBroker::LoopbackBroker(QObject* parent) : QObject(parent) {
+  connect(&server_, &QTcpServer::newConnection, this,
+          &LoopbackBroker::acceptConnections);
+}
+
+LoopbackBroker::~LoopbackBroker() {
+  close();
+}
+
+bool LoopbackBroker::listen(quint16 port) {
+  return server_.listen(QHostAddress::LocalHost, port);
+}
+
+void LoopbackBroker::close() {
+  server_.close();
+  disconnectClients();
+}
+
+void LoopbackBroker::disconnectClients() {
+  const auto sockets = connections_.keys();
+  for (auto* socket : sockets)
+    dropConnection(socket);
+}
+
+void LoopbackBroker::restart() {
+  disconnectClients();
+  retained_.clear();
+  persistent_sessions_.clear();
+}
+
+int LoopbackBroker::connectionCount() const {
+  int count = 0;
+  for (const auto& connection : connections_)
+    count += connection.session != nullptr;
+  return count;
+}
+
+void LoopbackBroker::publish(const QString& topic,
+                             const QByteArray& payload,
+                             quint8 qos,
+                             bool retain) {
+  route(topic, payload, qos, retain);
+}
+
+bool LoopbackBroker::topicMatches(const QString& filter, const QString& topic) {
+  const auto filter_levels = filter.split('/');
+  const auto topic_levels = topic.split('/');
+  for (qsizetype i = 0; i < filter_levels.size(); ++i) {
+    if (filter_levels[i] == "#")
+      return true;
+    if (i >= topic_levels.size())
+      return false;
+    if (filter_levels[i] != "+" && filter_levels[i] != topic_levels[i])
+      return false;
+  }
+  return filter_levels.size() == topic_levels.size();
+}
+
+void LoopbackBroker::acceptConnections() {
+  while (auto* socket = server_.nextPendingConnection()) {
+    connections_.insert(socket, {socket, {}, nullptr});
+    connect(socket, &QTcpSocket::readyRead, this, [this, socket]() {
+      auto itr = connections_.find(socket);
+      if (itr != connections_.end())
+        readPackets(*itr);
+    });
+    connect(socket, &QTcpSocket::disconnected, this,
+            [this, socket]() { dropConnection(socket); });
+  }
+}
+
+void LoopbackBroker::readPackets(Connection& connection) {
+  QTcpSocket* socket = connection.socket;
+  connection.buffer += socket->readAll();
+  for (;;) {
+    QByteArray& buffer = connection.buffer;
+    // Fixed header: type and flags, then 1-4 bytes of remaining length
+    quint32 length = 0;
+    qsizetype pos = 1;
+    bool complete = false;
+    for (int shift = 0; pos < buffer.size() && shift < 28; shift += 7) {
+      auto byte = quint8(buffer[pos++]);
+      length |= quint32(byte & 0x7f) << shift;
+      if ((byte & 0x80) == 0) {
+        complete = true;
+        break;
+      }
+    }
+    if (!complete) {
+      if (pos >= 5) {
+        qWarning("Loopback broker: malformed remaining length");
+        dropConnection(socket);
+      }
+      return;
+    }
+    if (buffer.size() < pos + qsizetype(length))
+      return;
+    auto header = quint8(buffer[0]);
+    QByteArray body = buffer.mid(pos, length);
+    buffer.remove(0, pos + length);
+    // The connection is gone once a packet asks to close it
+    if (!handlePacket(connection, header, body))
+      return;
+  }
+}
+
+bool LoopbackBroker::handlePacket(Connection& connection,
+                                  quint8 header,
+                                  const QByteArray& body) {
+  const quint8 type = header >> 4;
+  if (type != Connect && connection.session == nullptr) {
+    qWarning("Loopback broker: packet %d before CONNECT", type);
+    dropConnection(connection.socket);
+    return false;
+  }
+  switch (type) {
+    case Connect:
+      handleConnect(connection, body);
+      break;
+    case Publish:
+      handlePublish(connection, header, body);
+      break;
+    case Pubrec:
+      // Our QoS 2 delivery, released right away
+      sendPacket(connection, (Pubrel << 4) | 0x02, body.left(2));
+      break;
+    case Pubrel:
+      sendPacket(connection, Pubcomp << 4, body.left(2));
+      break;
+    case Puback:
+    case Pubcomp:
+      break;
+    case Subscribe:
+      handleSubscribe(connection, body);
+      break;
+    case Unsubscribe:
+      handleUnsubscribe(connection, body);
+      break;
+    case Pingreq:
+      sendPacket(connection, Pingresp << 4, {});
+      break;
+    case Disconnect:
+      dropConnection(connection.socket);
+      return false;
+    default:
+      qWarning("Loopback broker: unexpected packet type %d", type);
+      dropConnection(connection.socket);
+      return false;
+  }
+  return true;
+}
+
+void LoopbackBroker::handleConnect(Connection& connection,
+                                   const QByteArray& body) {
+  Reader reader(body);
+  reader.string();  // "MQTT", or "MQIsdp" for 3.1
+  reader.byte();    // Protocol level
+  const quint8 flags = reader.byte();
+  reader.u16();  // Keep alive
+  const QString client_id = QString::fromUtf8(reader.string());
+  const bool clean_session = flags & 0x02;
+
+  bool session_present = false;
+  if (clean_session) {
+    persistent_sessions_.remove(client_id);
+    connection.session = std::make_shared<Session>();
+  } else if (auto itr = persistent_sessions_.find(client_id);
+             itr != persistent_sessions_.end()) {
+    connection.session = *itr;
+    session_present = true;
+  } else {
+    connection.session = std::make_shared<Session>();
+    persistent_sessions_.insert(client_id, connection.session);
+  }
+  connection.session->client_id = client_id;
+
+  QByteArray connack;
+  connack.append(char(session_present));
+  connack.append(char(0));  // Accepted
+  sendPacket(connection, Connack << 4, connack);
+  emit clientConnected(client_id, clean_session);
+}
+
+void LoopbackBroker::handlePublish(Connection& connection,
+                                   quint8 header,
+                                   const QByteArray& body) {
+  const quint8 qos = (header >> 1) & 0x03;
+  const bool retain = header & 0x01;
+  Reader reader(body);
+  const QString topic = QString::fromUtf8(reader.string());
+  quint16 id = qos > 0 ? reader.u16() : 0;
+  const QByteArray payload = reader.rest();
+  ++publish_count_;
+
+  if (qos == 1)
+    sendPacket(connection, Puback << 4, packetId(id));
+  else if (qos == 2)
+    sendPacket(connection, Pubrec << 4, packetId(id));
+  emit messagePublished(topic, payload, qos, retain);
+  route(topic, payload, qos, retain);
+}
+
+void LoopbackBroker::handleSubscribe(Connection& connection,
+                                     const QByteArray& body) {
+  Reader reader(body);
+  const quint16 id = reader.u16();
+  QByteArray suback = packetId(id);
+  QStringList filters;
+  while (!reader.atEnd()) {
+    const QString filter = QString::fromUtf8(reader.string());
+    const quint8 qos = qMin<quint8>(reader.byte(), 2);
+    if (!reader.ok())
+      break;
+    connection.session->subscriptions.insert(filter, qos);
+    filters.append(filter);
+    suback.append(char(qos));
+  }
+  sendPacket(connection, Suback << 4, suback);
+
+  for (const auto& filter : filters) {
+    const quint8 granted = connection.session->subscriptions.value(filter);
+    for (auto itr = retained_.cbegin(); itr != retained_.cend(); ++itr) {
+      if (topicMatches(filter, itr.key()))
+        sendPublish(connection, itr.key(), itr.value(), granted, true);
+    }
+    emit subscribed(connection.session->client_id, filter, granted);
+  }
+}
+
+void LoopbackBroker::handleUnsubscribe(Connection& connection,
+                                       const QByteArray& body) {
+  Reader reader(body);
+  const quint16 id = reader.u16();
+  QStringList filters;
+  while (!reader.atEnd()) {
+    const QString filter = QString::fromUtf8(reader.string());
+    if (!reader.ok())
+      break;
+    connection.session->subscriptions.remove(filter);
+    filters.append(filter);
+  }
+  sendPacket(connection, Unsuback << 4, packetId(id));
+  for (const auto& filter : filters)
+    emit unsubscribed(connection.session->client_id, filter);
+}
+
+void LoopbackBroker::route(const QString& topic,
+                           const QByteArray& payload,
+                           quint8 qos,
+                           bool retain) {
+  if (retain) {
+    // An empty retained message clears the topic
+    if (payload.isEmpty())
+      retained_.remove(topic);
+    else
+      retained_.insert(topic, payload);
+  }
+  for (auto& connection : connections_) {
+    if (connection.session == nullptr)
+      continue;
+    // Overlapping filters deliver once, with the highest granted QoS
+    int granted = -1;
+    const auto& subscriptions = connection.session->subscriptions;
+    for (auto itr = subscriptions.cbegin(); itr != subscriptions.cend();
+         ++itr) {
+      if (itr.value() > granted && topicMatches(itr.key(), topic))
+        granted = itr.value();
+    }
+    if (granted >= 0)
+      sendPublish(connection, topic, payload, qMin<quint8>(qos, granted),
+                  false);
+  }
+}
+
+void LoopbackBroker::sendPublish(Connection& connection,
+                                 const QString& topic,
+                                 const QByteArray& payload,
+                                 quint8 qos,
+                                 bool retain) {
+  QByteArray body;
+  appendString(body, topic.toUtf8());
+  if (qos > 0) {
+    appendU16(body, connection.next_packet_id);
+    connection.next_packet_id =
+        connection.next_packet_id == 0xffff ? 1 : connection.next_packet_id + 1;
+  }
+  body.append(payload);
+  sendPacket(connection, quint8((Publish << 4) | (qos << 1) | retain), body);
+}
+
+void LoopbackBroker::sendPacket(Connection& connection,
+                                quint8 header,
+                                const QByteArray& body) {
+  QByteArray packet;
+  packet.reserve(body.size() + 5);
+  packet.append(char(header));
+  quint32 length = quint32(body.size());
+  do {
+    quint8 byte = length & 0x7f;
+    length >>= 7;
+    if (length > 0)
+      byte |= 0x80;
+    packet.append(char(byte));
+  } while (length > 0);
+  packet.append(body);
+  connection.socket->write(packet);
+}
+
+void LoopbackBroker::dropConnection(QTcpSocket* socket) {
+  if (!connections_.remove(socket))
+    return;
+  socket->disconnect(this);
+  socket->abort();
+  socket->deleteLater();
+}
+
+}  // namespace SideAssist::Qt::Testing
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <QByteArray>
+#include <QHash>
+#include <QObject>
+#include <QString>
+#include <QTcpServer>
+#include <memory>
+
+class QTcpSocket;
+
+namespace SideAssist::Qt::Testing {
+
+// Minimal in-process MQTT 3.1.1 broker on 127.0.0.1 for tests. It
+// handles CONNECT, SUBSCRIBE/UNSUBSCRIBE with + and # filters, PUBLISH
+// with QoS 0-2 handshakes and retained messages, and keeps the
+// subscriptions of cleanSession=false sessions across reconnects.
+// Messages are not queued for offline sessions, and will messages and
+// authentication are ignored.
+class LoopbackBroker : public QObject {
+  Q_OBJECT
+ public:
+  explicit LoopbackBroker(QObject* parent = nullptr);
+  ~LoopbackBroker();
+
+  // Listens on an ephemeral port unless one is given
+  bool listen(quint16 port = 0);
+  quint16 port() const { return server_.serverPort(); }
+  // Stops listening and drops every connection
+  void close();
+  // Drops every connection, as a broker restart would
+  void disconnectClients();
+  // Also forgets retained messages and sessions, as a broker restarted
+  // without persistence would
+  void restart();
+
+  // Publishes as if from another client
+  void publish(const QString& topic,
+               const QByteArray& payload,
+               quint8 qos = 0,
+               bool retain = false);
+
+  bool hasRetained(const QString& topic) const {
+    return retained_.contains(topic);
+  }
+  QByteArray retained(const QString& topic) const {
+    return retained_.value(topic);
+  }
+  int connectionCount() const;
+  // PUBLISH packets received from clients
+  quint64 publishCount() const { return publish_count_; }
+
+  static bool topicMatches(const QString& filter, const QString& topic);
+
+ signals:
+  void clientConnected(const QString& client_id, bool clean_session);
+  void subscribed(const QString& client_id, const QString& filter, quint8 qos);
+  void unsubscribed(const QString& client_id, const QString& filter);
+  // A client published a message
+  void messagePublished(const QString& topic,
+                        const QByteArray& payload,
+                        quint8 qos,
+                        bool retain);
+
+ private slots:
+  void acceptConnections();
+
+ private:
+  struct Session {
+    QString client_id;
+    // Filter -> granted QoS
+    QHash<QString, quint8> subscriptions;
+  };
+  struct Connection {
+    QTcpSocket* socket;
+    QByteArray buffer;
+    std::shared_ptr<Session> session;  // Set by CONNECT
+    quint16 next_packet_id = 1;
+  };
+
+  void readPackets(Connection& connection);
+  bool handlePacket(Connection& connection,
+                    quint8 header,
+                    const QByteArray& body);
+  void handleConnect(Connection& connection, const QByteArray& body);
+  void handlePublish(Connection& connection,
+                     quint8 header,
+                     const QByteArray& body);
+  void handleSubscribe(Connection& connection, const QByteArray& body);
+  void handleUnsubscribe(Connection& connection, const QByteArray& body);
+  void route(const QString& topic,
+             const QByteArray& payload,
+             quint8 qos,
+             bool retain);
+  void sendPublish(Connection& connection,
+                   const QString& topic,
+                   const QByteArray& payload,
+                   quint8 qos,
+                   bool retain);
+  void sendPacket(Connection& connection,
+                  quint8 header,
+                  const QByteArray& body);
+  void dropConnection(QTcpSocket* socket);
+
+  QTcpServer server_;
+  QHash<QTcpSocket*, Connection> connections_;
+  // Sessions of clients that connected with cleanSession=false
+  QHash<QString, std::shared_ptr<Session> > persistent_sessions_;
+  QHash<QString, QByteArray> retained_;
+  quint64 publish_count_ = 0;
+};
+
+}  // namespace SideAssist::Qt::Testing
@@ -0,0 +1,571 @@
+#include <gtest/gtest.h>
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QThreadPool>
+#include <QTimer>
+#include <map>
+#include <numeric>
+#include "client.hpp"
+#include "loopback_broker.hpp"
+#include "payload.hpp"
+#include "value_validator.hpp"
+
+namespace {
+
+using SideAssist::Qt::Client;
+using SideAssist::Qt::Testing::LoopbackBroker;
+namespace Payload = SideAssist::Qt::Payload;
+namespace Validator = SideAssist::Qt::ValueValidator;
+
+// Sockets need an application, gtest_main does not create one
+void ensureApplication() {
+  static int argc = 1;
+  static char name[] = "SideAssist.Test";
+  static char* argv[] = {name, nullptr};
+  if (QCoreApplication::instance() == nullptr)
+    new QCoreApplication(argc, argv);
+}
+
+// Runs the event loop until pred() holds or timeout_msec passed
+template <typename Pred>
+bool waitFor(Pred pred, int timeout_msec = 5000) {
+  QElapsedTimer timer;
+  timer.start();
+  while (!pred()) {
+    if (timer.elapsed() > timeout_msec)
+      return false;
+    QEventLoop loop;
+    QTimer::singleShot(5, &loop, &QEventLoop::quit);
+    loop.exec();
+  }
+  return true;
+}
+
+QByteArray valuePayload(const QJsonValue& value) {
+  QByteArray payload;
+  Payload::writeValue(value, payload);
+  return payload;
+}
+
+QJsonValue readPayload(const QByteArray& payload) {
+  QJsonValue value;
+  EXPECT_TRUE(Payload::readValue(payload, value));
+  return value;
+}
+
+class ClientLoopback : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    ensureApplication();
+    ASSERT_TRUE(broker.listen());
+    client = std::make_unique<Client>(QHostAddress::LocalHost, broker.port());
+    client->setClientId("test");
+  }
+
+  void connectClient() {
+    client->connectToHost();
+    ASSERT_TRUE(waitFor([this]() {
+      return client->connectionState() == Client::ConnectionState::Connected;
+    }));
+  }
+
+  // Waits for the SUBACK of filter, after which publishes reach the client
+  void waitForSubscription(const QString& filter) {
+    bool done = false;
+    auto connection = QObject::connect(
+        &broker, &LoopbackBroker::subscribed,
+        [&](const QString&, const QString& subscribed, quint8) {
+          done |= subscribed == filter;
+        });
+    EXPECT_TRUE(waitFor([&]() { return done; }));
+    QObject::disconnect(connection);
+  }
+
+  LoopbackBroker broker;
+  std::unique_ptr<Client> client;
+};
+
+}  // namespace
+
+TEST(LoopbackBroker, TopicMatches) {
+  EXPECT_TRUE(LoopbackBroker::topicMatches("a/b", "a/b"));
+  EXPECT_FALSE(LoopbackBroker::topicMatches("a/b", "a/b/c"));
+  EXPECT_TRUE(LoopbackBroker::topicMatches("a/+/c", "a/b/c"));
+  EXPECT_FALSE(LoopbackBroker::topicMatches("a/+", "a/b/c"));
+  EXPECT_TRUE(LoopbackBroker::topicMatches("a/#", "a/b/c"));
+  EXPECT_TRUE(LoopbackBroker::topicMatches("#", "a"));
+}
+
+TEST_F(ClientLoopback, UploadsValuesAndValidators) {
+  auto option = client->addOption("int", false);
+  option->setValidator(std::make_shared<Validator::SingleType>(
+      Validator::ValueTypeFieldEnum::Integer));
+  option->setValue(3);
+  auto parameter = client->addParameter("param");
+  parameter->setValue("text");
+  connectClient();
+
+  ASSERT_TRUE(waitFor([this]() {
+    return broker.hasRetained("side_assist/test/option/int") &&
+           broker.hasRetained("side_assist/test/option/int/validator") &&
+           broker.hasRetained("side_assist/test/param/param");
+  }));
+  EXPECT_EQ(readPayload(broker.retained("side_assist/test/option/int")),
+            QJsonValue(3));
+  EXPECT_EQ(readPayload(broker.retained("side_assist/test/param/param")),
+            QJsonValue("text"));
+  auto validator = QJsonDocument::fromJson(
+      broker.retained("side_assist/test/option/int/validator"));
+  EXPECT_TRUE(validator.object().contains("validator"));
+
+  // Later changes are published as well
+  parameter->setValue("changed");
+  EXPECT_TRUE(waitFor([this]() {
+    return readPayload(broker.retained("side_assist/test/param/param")) ==
+           QJsonValue("changed");
+  }));
+}
+
+TEST_F(ClientLoopback, CoalescesValueBursts) {
+  auto burst = client->addParameter("burst");
+  auto every = client->addParameter("every");
+  every->setCoalescing(false);
+  connectClient();
+  std::map<QString, std::vector<QJsonValue> > publishes;
+  QObject::connect(&broker, &LoopbackBroker::messagePublished,
+                   [&](const QString& topic, const QByteArray& payload) {
+                     publishes[topic].push_back(readPayload(payload));
+                   });
+
+  // All in one event loop turn
+  std::vector<QJsonValue> all;
+  for (int i = 1; i <= 10; ++i) {
+    burst->setValue(i);
+    every->setValue(i);
+    all.push_back(i);
+  }
+  ASSERT_TRUE(waitFor([&]() {
+    return publishes["side_assist/test/param/every"].size() == all.size() &&
+           !publishes["side_assist/test/param/burst"].empty();
+  }));
+  waitFor([]() { return false; }, 100);
+  EXPECT_EQ(publishes["side_assist/test/param/burst"],
+            std::vector<QJsonValue>{QJsonValue(10)});
+  EXPECT_EQ(publishes["side_assist/test/param/every"], all);
+}
+
+TEST_F(ClientLoopback, PublishesRightAwayWithoutCoalescingInterval) {
+  using TopicClass = SideAssist::Qt::ClientMetrics::TopicClass;
+  client->setPublishCoalescingInterval(-1);
+  auto parameter = client->addParameter("param");
+  connectClient();
+  std::vector<QJsonValue> publishes;
+  QObject::connect(&broker, &LoopbackBroker::messagePublished,
+                   [&](const QString& topic, const QByteArray& payload) {
+                     if (topic == "side_assist/test/param/param")
+                       publishes.push_back(readPayload(payload));
+                   });
+
+  const auto before = client->metrics().published(TopicClass::ParameterValue);
+  for (int i = 1; i <= 3; ++i) {
+    parameter->setValue(i);
+    // Sent from within setValue(), not on a later turn
+    EXPECT_EQ(client->metrics().published(TopicClass::ParameterValue),
+              before + i);
+  }
+  EXPECT_TRUE(waitFor([&]() { return publishes.size() == 3; }));
+  EXPECT_EQ(publishes, (std::vector<QJsonValue>{1, 2, 3}));
+}
+
+TEST_F(ClientLoopback, AppliesDeliveryPolicy) {
+  SideAssist::Qt::DeliveryPolicy fire_and_forget;
+  fire_and_forget.qos = 0;
+  fire_and_forget.retain = false;
+  auto sample = client->addParameter("sample", fire_and_forget);
+  auto state = client->addParameter("state");
+  struct Delivery {
+    quint8 qos;
+    bool retain;
+  };
+  std::map<QString, Delivery> deliveries;
+  QObject::connect(
+      &broker, &LoopbackBroker::messagePublished,
+      [&](const QString& topic, const QByteArray&, quint8 qos, bool retain) {
+        deliveries[topic] = {qos, retain};
+      });
+  connectClient();
+
+  sample->setValue(1);
+  state->setValue(2);
+  ASSERT_TRUE(waitFor([&]() {
+    return deliveries.count("side_assist/test/param/sample") &&
+           deliveries.count("side_assist/test/param/state");
+  }));
+  EXPECT_EQ(deliveries["side_assist/test/param/sample"].qos, 0);
+  EXPECT_FALSE(deliveries["side_assist/test/param/sample"].retain);
+  EXPECT_FALSE(broker.hasRetained("side_assist/test/param/sample"));
+  EXPECT_EQ(deliveries["side_assist/test/param/state"].qos, 2);
+  EXPECT_TRUE(deliveries["side_assist/test/param/state"].retain);
+  EXPECT_EQ(readPayload(broker.retained("side_assist/test/param/state")),
+            QJsonValue(2));
+}
+
+TEST_F(ClientLoopback, AppliesRemoteSet) {
+  auto option = client->addOption("int", false);
+  option->setValidator(std::make_shared<Validator::SingleType>(
+      Validator::ValueTypeFieldEnum::Integer));
+  connectClient();
+  waitForSubscription("side_assist/test/option/int/set");
+
+  broker.publish("side_assist/test/option/int/set", valuePayload(7), 2);
+  ASSERT_TRUE(waitFor([&]() { return option->value() == QJsonValue(7); }));
+  EXPECT_EQ(client->metrics().processReceivedTime().count(), 1u);
+  // The accepted value is saved back to the broker
+  EXPECT_TRUE(waitFor([this]() {
+    return readPayload(broker.retained("side_assist/test/option/int")) ==
+           QJsonValue(7);
+  }));
+
+  broker.publish("side_assist/test/option/int/set", valuePayload("text"), 2);
+  ASSERT_TRUE(waitFor(
+      [this]() { return client->metrics().validationFailures() == 1; }));
+  EXPECT_EQ(option->value(), QJsonValue(7));
+}
+
+TEST_F(ClientLoopback, DropsOversizedPayloads) {
+  using TopicClass = SideAssist::Qt::ClientMetrics::TopicClass;
+  client->setMaxPayloadSize(TopicClass::OptionSet, 64);
+  auto option = client->addOption("text", false);
+  connectClient();
+  waitForSubscription("side_assist/test/option/text/set");
+
+  broker.publish("side_assist/test/option/text/set",
+                 valuePayload(QString(100, 'x')), 1);
+  broker.publish("side_assist/test/option/text/set", valuePayload("short"),
+                 1);
+  ASSERT_TRUE(
+      waitFor([&]() { return option->value() == QJsonValue("short"); }));
+  EXPECT_EQ(client->metrics().oversizedPayloads(TopicClass::OptionSet), 1u);
+}
+
+TEST_F(ClientLoopback, CompactsBackloggedSets) {
+  auto option = client->addOption("slider", false);
+  connectClient();
+  waitForSubscription("side_assist/test/option/slider/set");
+
+  // Written in one go, so the client reads them as one backlog
+  for (int i = 1; i <= 100; ++i)
+    broker.publish("side_assist/test/option/slider/set", valuePayload(i), 0);
+  ASSERT_TRUE(waitFor([&]() { return option->value() == QJsonValue(100); }));
+  EXPECT_GT(client->metrics().compactedSets(), 0u);
+}
+
+TEST_F(ClientLoopback, RestoresRemoteSavedValue) {
+  broker.publish("side_assist/test/option/saved", valuePayload(11), 1, true);
+  auto option = client->addOption("saved", true);
+  connectClient();
+  EXPECT_TRUE(waitFor([&]() { return option->value() == QJsonValue(11); }));
+}
+
+TEST_F(ClientLoopback, ReconnectsAfterBrokerDrop) {
+  client->setReconnectBackoff(10, 50);
+  auto parameter = client->addParameter("param");
+  connectClient();
+
+  broker.disconnectClients();
+  ASSERT_TRUE(waitFor([this]() {
+    return client->connectionState() != Client::ConnectionState::Connected;
+  }));
+  // Changed while disconnected, resynced on reconnect
+  parameter->setValue(5);
+  ASSERT_TRUE(waitFor([this]() {
+    return client->connectionState() == Client::ConnectionState::Connected;
+  }));
+  EXPECT_GE(client->totalReconnectAttempts(), 1u);
+  EXPECT_EQ(client->reconnectAttempts(), 0);
+  EXPECT_TRUE(waitFor([this]() {
+    return readPayload(broker.retained("side_assist/test/param/param")) ==
+           QJsonValue(5);
+  }));
+}
+
+TEST_F(ClientLoopback, SkipsUnchangedValidatorsOnReconnect) {
+  client->setReconnectBackoff(10, 50);
+  client->setIncrementalResync(true);
+  auto same = client->addOption("same", false);
+  same->setValidator(std::make_shared<Validator::SingleType>(
+      Validator::ValueTypeFieldEnum::Integer));
+  auto changed = client->addOption("changed", false);
+  changed->setValidator(std::make_shared<Validator::SingleType>(
+      Validator::ValueTypeFieldEnum::Integer));
+  std::map<QString, int> validator_publishes;
+  QObject::connect(&broker, &LoopbackBroker::messagePublished,
+                   [&](const QString& topic) {
+                     if (topic.endsWith("/validator"))
+                       ++validator_publishes[topic];
+                   });
+  connectClient();
+  ASSERT_TRUE(waitFor([&]() { return validator_publishes.size() == 2; }));
+  // Let the PUBCOMPs through
+  waitFor([]() { return false; }, 100);
+
+  int reconnects = 0;
+  QObject::connect(&broker, &LoopbackBroker::clientConnected,
+                   [&](const QString&, bool) { ++reconnects; });
+  broker.disconnectClients();
+  ASSERT_TRUE(waitFor([this]() {
+    return client->connectionState() != Client::ConnectionState::Connected;
+  }));
+  changed->setValidator(std::make_shared<Validator::SingleType>(
+      Validator::ValueTypeFieldEnum::String));
+  ASSERT_TRUE(waitFor([&]() { return reconnects == 1; }));
+  ASSERT_TRUE(waitFor([&]() {
+    return validator_publishes["side_assist/test/option/changed/validator"] ==
+           2;
+  }));
+  waitFor([]() { return false; }, 100);
+  EXPECT_EQ(validator_publishes["side_assist/test/option/same/validator"], 1);
+  EXPECT_EQ(validator_publishes["side_assist/test/option/changed/validator"],
+            2);
+}
+
+TEST_F(ClientLoopback, FullUploadAfterBrokerRestart) {
+  client->setReconnectBackoff(10, 50);
+  auto parameter = client->addParameter("param");
+  parameter->setValue(1);
+  connectClient();
+  ASSERT_TRUE(waitFor([this]() {
+    return broker.hasRetained("side_assist/test/param/param");
+  }));
+
+  int reconnects = 0;
+  QObject::connect(&broker, &LoopbackBroker::clientConnected,
+                   [&](const QString&, bool) { ++reconnects; });
+  // Unchanged since its last ack, but the broker lost it
+  broker.restart();
+  ASSERT_TRUE(waitFor([&]() { return reconnects == 1; }));
+  EXPECT_TRUE(waitFor([this]() {
+    return broker.hasRetained("side_assist/test/param/param");
+  }));
+  EXPECT_EQ(readPayload(broker.retained("side_assist/test/param/param")),
+            QJsonValue(1));
+}
+
+TEST_F(ClientLoopback, ValidatesOnThreadPool) {
+  QThreadPool pool;
+  client->setValidationThreadPool(&pool);
+  auto option = client->addOption("int", false);
+  option->setValidator(std::make_shared<Validator::SingleType>(
+      Validator::ValueTypeFieldEnum::Integer));
+  // Every message is applied, so the order can be checked
+  option->setCompactRemoteSets(false);
+  std::vector<int> seen;
+  QObject::connect(option.get(), &SideAssist::Qt::NamedValue::valueChanged,
+                   [&](const QJsonValue& value) {
+                     seen.push_back(value.toInt());
+                   });
+  connectClient();
+  waitForSubscription("side_assist/test/option/int/set");
+
+  for (int i = 1; i <= 20; ++i)
+    broker.publish("side_assist/test/option/int/set", valuePayload(i), 1);
+  ASSERT_TRUE(waitFor([&]() { return option->value() == QJsonValue(20); }));
+  std::vector<int> expected(20);
+  std::iota(expected.begin(), expected.end(), 1);
+  EXPECT_EQ(seen, expected);
+  // Before the pool goes away
+  client.reset();
+}
+
+TEST_F(ClientLoopback, RejectsOnThreadPool) {
+  QThreadPool pool;
+  client->setValidationThreadPool(&pool);
+  auto option = client->addOption("int", false);
+  option->setValidator(std::make_shared<Validator::SingleType>(
+      Validator::ValueTypeFieldEnum::Integer));
+  connectClient();
+  waitForSubscription("side_assist/test/option/int/set");
+
+  broker.publish("side_assist/test/option/int/set", valuePayload(3), 1);
+  ASSERT_TRUE(waitFor([&]() { return option->value() == QJsonValue(3); }));
+  broker.publish("side_assist/test/option/int/set", valuePayload("text"), 1);
+  ASSERT_TRUE(waitFor(
+      [this]() { return client->metrics().validationFailures() == 1; }));
+  // The rejected value must not land after the failure was counted either
+  waitFor([]() { return false; }, 50);
+  EXPECT_EQ(option->value(), QJsonValue(3));
+  client.reset();
+}
+
+TEST_F(ClientLoopback, ThrottlesPublishes) {
+  auto parameter = client->addParameter("rate");
+  parameter->setMaxPublishRate(5);
+  connectClient();
+  QElapsedTimer clock;
+  std::vector<std::pair<qint64, QJsonValue> > publishes;
+  QObject::connect(&broker, &LoopbackBroker::messagePublished,
+                   [&](const QString& topic, const QByteArray& payload) {
+                     if (topic == "side_assist/test/param/rate")
+                       publishes.emplace_back(clock.elapsed(),
+                                              readPayload(payload));
+                   });
+  // Past the first interval, so the first change goes out right away
+  waitFor([]() { return false; }, 250);
+
+  clock.start();
+  for (int i = 1; i <= 5; ++i)
+    parameter->setValue(i);
+  ASSERT_TRUE(waitFor([&]() {
+    return !publishes.empty() && publishes.back().second == QJsonValue(5);
+  }));
+  // Nothing more once the latest value is out
+  waitFor([]() { return false; }, 300);
+  ASSERT_EQ(publishes.size(), 2u);
+  EXPECT_EQ(publishes[0].second, QJsonValue(1));
+  // The trailing publish waits for the 200 ms interval, with timer slack
+  EXPECT_GE(publishes[1].first, 180);
+}
+
+TEST_F(ClientLoopback, FlushesLatestOfflineValue) {
+  client->setPersistentSession(true);
+  client->setIncrementalResync(true);
+  client->setAutoReconnect(false);
+  auto parameter = client->addParameter("param");
+  parameter->setValue(0);
+  connectClient();
+  ASSERT_TRUE(waitFor([this]() {
+    return broker.hasRetained("side_assist/test/param/param");
+  }));
+
+  broker.disconnectClients();
+  ASSERT_TRUE(waitFor([this]() {
+    return client->connectionState() == Client::ConnectionState::Disconnected;
+  }));
+  for (int i = 1; i <= 3; ++i) {
+    parameter->setValue(i);
+    // Let each change leave the coalescing stage on its own
+    waitFor([]() { return false; }, 20);
+  }
+  EXPECT_EQ(client->offlineQueueSize(), 1);
+
+  std::vector<QJsonValue> publishes;
+  QObject::connect(&broker, &LoopbackBroker::messagePublished,
+                   [&](const QString& topic, const QByteArray& payload) {
+                     if (topic == "side_assist/test/param/param")
+                       publishes.push_back(readPayload(payload));
+                   });
+  connectClient();
+  ASSERT_TRUE(waitFor([&]() { return !publishes.empty(); }));
+  waitFor([]() { return false; }, 100);
+  EXPECT_EQ(publishes, std::vector<QJsonValue>{QJsonValue(3)});
+  EXPECT_EQ(client->offlineQueueSize(), 0);
+
+  // The flushed value was acknowledged, so nothing changed since
+  broker.disconnectClients();
+  ASSERT_TRUE(waitFor([this]() {
+    return client->connectionState() == Client::ConnectionState::Disconnected;
+  }));
+  connectClient();
+  waitFor([]() { return false; }, 100);
+  EXPECT_EQ(publishes.size(), 1u);
+}
+
+TEST_F(ClientLoopback, OfflineQueueOverflowUploadsAll) {
+  client->setPersistentSession(true);
+  client->setIncrementalResync(true);
+  client->setAutoReconnect(false);
+  client->setOfflineQueueCapacity(1);
+  auto first = client->addParameter("first");
+  auto second = client->addParameter("second");
+  connectClient();
+
+  broker.disconnectClients();
+  ASSERT_TRUE(waitFor([this]() {
+    return client->connectionState() == Client::ConnectionState::Disconnected;
+  }));
+  first->setValue(1);
+  second->setValue(2);
+  ASSERT_TRUE(waitFor([this]() { return client->offlineQueueSize() == 1; }));
+
+  connectClient();
+  EXPECT_TRUE(waitFor([this]() {
+    return broker.hasRetained("side_assist/test/param/first") &&
+           broker.hasRetained("side_assist/test/param/second");
+  }));
+  EXPECT_EQ(readPayload(broker.retained("side_assist/test/param/first")),
+            QJsonValue(1));
+  EXPECT_EQ(readPayload(broker.retained("side_assist/test/param/second")),
+            QJsonValue(2));
+  EXPECT_EQ(client->offlineQueueSize(), 0);
+}
+
+TEST_F(ClientLoopback, WildcardSubscriptions) {
+  using TopicClass = SideAssist::Qt::ClientMetrics::TopicClass;
+  client->setSubscriptionMode(Client::SubscriptionMode::Wildcard);
+  broker.publish("side_assist/test/option/first", valuePayload(1), 1, true);
+  broker.publish("side_assist/test/option/unknown", valuePayload(9), 1, true);
+  auto first = client->addOption("first", true);
+  auto second = client->addOption("second", true);
+  bool unsubscribed = false;
+  QObject::connect(&broker, &LoopbackBroker::unsubscribed,
+                   [&](const QString&, const QString& filter) {
+                     unsubscribed |= filter == "side_assist/test/option/+";
+                   });
+  connectClient();
+
+  // The retained value of a known option is its initial value
+  ASSERT_TRUE(waitFor([&]() { return first->value() == QJsonValue(1); }));
+  // The unknown one is only counted
+  ASSERT_TRUE(waitFor([this]() {
+    return client->metrics().received(TopicClass::Unknown) == 1;
+  }));
+  EXPECT_TRUE(second->value().isUndefined());
+  // Still waiting for second
+  waitFor([]() { return false; }, 50);
+  EXPECT_FALSE(unsubscribed);
+
+  second->setValue(5);
+  EXPECT_TRUE(waitFor([&]() { return unsubscribed; }));
+}
+
+TEST_F(ClientLoopback, WildcardAddsOptionsWithoutResubscribing) {
+  using TopicClass = SideAssist::Qt::ClientMetrics::TopicClass;
+  client->setSubscriptionMode(Client::SubscriptionMode::Wildcard);
+  broker.publish("side_assist/test/option/late", valuePayload(7), 1, true);
+  broker.publish("side_assist/test/option/batch", valuePayload(8), 1, true);
+  auto first = client->addOption("first", true);
+  int filter_subscribes = 0;
+  QObject::connect(&broker, &LoopbackBroker::subscribed,
+                   [&](const QString&, const QString& filter, quint8) {
+                     filter_subscribes += filter == "side_assist/test/option/+";
+                   });
+  connectClient();
+  // Both retained values came by before their options were added
+  ASSERT_TRUE(waitFor([this]() {
+    return client->metrics().received(TopicClass::Unknown) == 2;
+  }));
+  ASSERT_EQ(filter_subscribes, 1);
+
+  auto late = client->addOption("late", true);
+  auto batch = client->addOptions({"batch"}, true);
+  EXPECT_TRUE(waitFor([&]() {
+    return late->value() == QJsonValue(7) &&
+           batch[0]->value() == QJsonValue(8);
+  }));
+  waitFor([]() { return false; }, 50);
+  EXPECT_EQ(filter_subscribes, 1);
+  EXPECT_TRUE(first->value().isUndefined());
+}
+
+TEST_F(ClientLoopback, AddOptionsKeepsExistingValues) {
+  auto existing = client->addOption("a", false);
+  auto values = client->addOptions({"a", "b", "b"}, false);
+  ASSERT_EQ(values.size(), 3u);
+  EXPECT_EQ(values[0], existing);
+  EXPECT_NE(values[1], nullptr);
+  EXPECT_EQ(values[1], values[2]);
+  EXPECT_EQ(client->addOption("b", false), values[1]);
+}
@@ -0,0 +1,57 @@
+#include <gtest/gtest.h>
+#include <QJsonArray>
+#include "client_metrics.hpp"
+
+using SideAssist::Qt::LatencyHistogram;
+
+TEST(LatencyHistogram, Buckets) {
+  LatencyHistogram histogram;
+  EXPECT_EQ(histogram.percentile(0.5), 0u);
+
+  histogram.record(0);
+  histogram.record(1);
+  histogram.record(3);
+  histogram.record(1000);
+  EXPECT_EQ(histogram.count(), 4u);
+  EXPECT_EQ(histogram.sum(), 1004u);
+  EXPECT_EQ(histogram.max(), 1000u);
+  EXPECT_EQ(histogram.bucket(0), 1u);
+  EXPECT_EQ(histogram.bucket(1), 1u);
+  EXPECT_EQ(histogram.bucket(2), 1u);
+  EXPECT_EQ(histogram.bucket(10), 1u);
+
+  // Percentiles report the upper bound of their bucket
+  EXPECT_EQ(histogram.percentile(0.0), 1u);
+  EXPECT_EQ(histogram.percentile(0.5), 2u);
+  EXPECT_EQ(histogram.percentile(1.0), 1024u);
+
+  // Negative durations count as 0, huge ones land in the last bucket
+  histogram.record(-5);
+  histogram.record(qint64(1) << 40);
+  EXPECT_EQ(histogram.bucket(0), 2u);
+  EXPECT_EQ(histogram.bucket(LatencyHistogram::bucket_count - 1), 1u);
+  EXPECT_EQ(histogram.percentile(1.0), quint64(1) << 40);
+
+  histogram.reset();
+  EXPECT_EQ(histogram.count(), 0u);
+  EXPECT_EQ(histogram.max(), 0u);
+}
+
+TEST(LatencyHistogram, Json) {
+  LatencyHistogram histogram;
+  histogram.record(3);
+  auto json = histogram.toJson();
+  EXPECT_EQ(json["count"].toInteger(), 1);
+  EXPECT_EQ(json["max_us"].toInteger(), 3);
+  // Trailing empty buckets are left out
+  EXPECT_EQ(json["log2_buckets"].toArray().size(), 3);
+}
+
+TEST(ClientMetrics, Json) {
+  SideAssist::Qt::ClientMetrics metrics;
+  auto json = metrics.toJson();
+  EXPECT_EQ(json["bytes_in"].toInteger(), 0);
+  EXPECT_TRUE(json["received"].toObject().isEmpty());
+  EXPECT_EQ(json["handle_message_time"].toObject()["count"].toInteger(), 0);
+  EXPECT_EQ(json["process_received_time"].toObject()["count"].toInteger(), 0);
+}
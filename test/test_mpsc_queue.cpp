@@ -0,0 +1,52 @@
+#include <gtest/gtest.h>
+#include <thread>
+#include <vector>
+#include "mpsc_queue.hpp"
+
+TEST(MpscQueue, Bounded) {
+  SideAssist::Qt::MpscQueue<int> queue(5);
+  EXPECT_EQ(queue.capacity(), 8u);
+  for (int i = 0; i < 8; ++i)
+    EXPECT_TRUE(queue.tryPush(i));
+  EXPECT_FALSE(queue.tryPush(8));
+
+  int value;
+  for (int i = 0; i < 8; ++i) {
+    EXPECT_TRUE(queue.tryPop(value));
+    EXPECT_EQ(value, i);
+  }
+  EXPECT_FALSE(queue.tryPop(value));
+  EXPECT_TRUE(queue.tryPush(8));
+}
+
+TEST(MpscQueue, ConcurrentProducers) {
+  constexpr int producers = 4;
+  constexpr int per_producer = 100000;
+  SideAssist::Qt::MpscQueue<std::pair<int, int>> queue(1024);
+
+  std::vector<std::thread> threads;
+  for (int p = 0; p < producers; ++p) {
+    threads.emplace_back([&queue, p]() {
+      for (int i = 0; i < per_producer; ++i) {
+        while (!queue.tryPush({p, i}))
+          std::this_thread::yield();
+      }
+    });
+  }
+
+  // Every producer's items arrive exactly once and in order
+  std::vector<int> next(producers, 0);
+  std::pair<int, int> item;
+  for (int received = 0; received < producers * per_producer;) {
+    if (!queue.tryPop(item)) {
+      std::this_thread::yield();
+      continue;
+    }
+    ASSERT_EQ(item.second, next[item.first]);
+    ++next[item.first];
+    ++received;
+  }
+  for (auto& thread : threads)
+    thread.join();
+  EXPECT_FALSE(queue.tryPop(item));
+}
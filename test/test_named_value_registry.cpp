@@ -0,0 +1,92 @@
+#include <gtest/gtest.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "named_value_registry.hpp"
+
+static std::shared_ptr<SideAssist::Qt::NamedValue> makeValue(
+    const QString& name) {
+  return std::make_shared<SideAssist::Qt::NamedValue>(
+      name, QJsonValue(QJsonValue::Undefined));
+}
+
+TEST(NamedValueRegistry, EmplaceAndFind) {
+  SideAssist::Qt::NamedValueRegistry registry;
+  EXPECT_EQ(registry.find("a"), nullptr);
+
+  auto [a, created] = registry.emplace("a", makeValue("a"));
+  EXPECT_TRUE(created);
+  EXPECT_EQ((*a)->name(), "a");
+
+  auto [again, created_again] = registry.emplace("a", makeValue("a"));
+  EXPECT_FALSE(created_again);
+  EXPECT_EQ(again, a);
+  EXPECT_EQ(registry.find("a"), a);
+  EXPECT_EQ(registry.size(), 1u);
+}
+
+TEST(NamedValueRegistry, Grow) {
+  SideAssist::Qt::NamedValueRegistry registry;
+  std::vector<const std::shared_ptr<SideAssist::Qt::NamedValue>*> entries;
+  for (int i = 0; i < 1000; ++i)
+    entries.push_back(registry.emplace(QString::number(i),
+                                       makeValue(QString::number(i)))
+                          .first);
+  for (int i = 0; i < 1000; ++i)
+    EXPECT_EQ(registry.find(QString::number(i)), entries[i]);
+  EXPECT_EQ(registry.find("1000"), nullptr);
+
+  auto values = registry.values();
+  ASSERT_EQ(values.size(), 1000u);
+  for (int i = 0; i < 1000; ++i)
+    EXPECT_EQ(values[i]->name(), QString::number(i));
+}
+
+TEST(NamedValueRegistry, BulkEmplace) {
+  SideAssist::Qt::NamedValueRegistry registry;
+  registry.emplace("3", makeValue("3"));
+
+  std::vector<std::pair<QString, std::shared_ptr<SideAssist::Qt::NamedValue> > >
+      items;
+  for (int i = 0; i < 100; ++i)
+    items.emplace_back(QString::number(i), makeValue(QString::number(i)));
+  auto results = registry.emplace(std::move(items));
+
+  ASSERT_EQ(results.size(), 100u);
+  for (int i = 0; i < 100; ++i) {
+    EXPECT_EQ(results[i].second, i != 3);
+    EXPECT_EQ(registry.find(QString::number(i)), results[i].first);
+  }
+  EXPECT_EQ(registry.size(), 100u);
+}
+
+TEST(NamedValueRegistry, ConcurrentReaders) {
+  constexpr int count = 20000;
+  SideAssist::Qt::NamedValueRegistry registry;
+  std::atomic<bool> done = false;
+  std::atomic<bool> failed = false;
+
+  // Readers must see every name that was inserted before they look
+  std::vector<std::thread> readers;
+  std::atomic<int> inserted = 0;
+  for (int r = 0; r < 4; ++r) {
+    readers.emplace_back([&]() {
+      while (!done.load()) {
+        int n = inserted.load();
+        for (int i = n - 1; i >= 0 && i >= n - 64; --i) {
+          auto* ptr = registry.find(QString::number(i));
+          if (ptr == nullptr || (*ptr)->name() != QString::number(i))
+            failed = true;
+        }
+      }
+    });
+  }
+  for (int i = 0; i < count; ++i) {
+    registry.emplace(QString::number(i), makeValue(QString::number(i)));
+    inserted.store(i + 1);
+  }
+  done = true;
+  for (auto& reader : readers)
+    reader.join();
+  EXPECT_FALSE(failed.load());
+}
@@ -0,0 +1,207 @@
+#include <gtest/gtest.h>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include "payload.hpp"
+
+static QJsonValue roundTrip(const QJsonValue& value) {
+  QByteArray buf;
+  SideAssist::Qt::Payload::writeValue(value, buf);
+  QJsonParseError error;
+  auto doc = QJsonDocument::fromJson(buf, &error);
+  EXPECT_EQ(error.error, QJsonParseError::NoError) << buf.constData();
+  return doc["value"];
+}
+
+TEST(Payload, WriteScalar) {
+  EXPECT_EQ(roundTrip(QJsonValue()), QJsonValue());
+  EXPECT_EQ(roundTrip(true), QJsonValue(true));
+  EXPECT_EQ(roundTrip(false), QJsonValue(false));
+  EXPECT_EQ(roundTrip(0), QJsonValue(0));
+  EXPECT_EQ(roundTrip(-12748941), QJsonValue(-12748941));
+  EXPECT_EQ(roundTrip(qint64(1) << 60), QJsonValue(qint64(1) << 60));
+  EXPECT_EQ(roundTrip(2.3), QJsonValue(2.3));
+  EXPECT_EQ(roundTrip(-1e-300), QJsonValue(-1e-300));
+  EXPECT_EQ(roundTrip("str"), QJsonValue("str"));
+  EXPECT_EQ(roundTrip(""), QJsonValue(""));
+}
+
+TEST(Payload, WriteEscapedString) {
+  QString str = QString::fromUtf8("\"quote\" \\ \n\t\x01 \xc3\xa9 \xe4\xb8\xad ") +
+                QString::fromUcs4(U"\U0001F600");
+  EXPECT_EQ(roundTrip(str), QJsonValue(str));
+}
+
+TEST(Payload, WriteCompact) {
+  QByteArray buf;
+  SideAssist::Qt::Payload::writeValue(QJsonValue(42), buf);
+  EXPECT_EQ(buf, QByteArray(R"({"value":42})"));
+  SideAssist::Qt::Payload::writeValue(QJsonValue(true), buf);
+  EXPECT_EQ(buf, QByteArray(R"({"value":true})"));
+}
+
+TEST(Payload, WriteContainer) {
+  QJsonArray arr({1, "two", QJsonObject({qMakePair("three", 3.5)})});
+  EXPECT_EQ(roundTrip(arr), QJsonValue(arr));
+  QJsonObject obj({qMakePair("list", arr), qMakePair("null", QJsonValue())});
+  EXPECT_EQ(roundTrip(obj), QJsonValue(obj));
+}
+
+TEST(Payload, ReadBothEncodings) {
+  using SideAssist::Qt::Payload::Encoding;
+  QJsonArray arr({1, 2.5, "three", QJsonValue()});
+  for (auto encoding : {Encoding::Json, Encoding::Cbor}) {
+    for (const auto& input :
+         {QJsonValue(true), QJsonValue(-42), QJsonValue(0.125),
+          QJsonValue("str"), QJsonValue(), QJsonValue(arr)}) {
+      QByteArray buf;
+      SideAssist::Qt::Payload::writeValue(input, buf, encoding);
+      EXPECT_EQ(SideAssist::Qt::Payload::detectEncoding(buf), encoding);
+      QJsonValue value;
+      QString error;
+      EXPECT_TRUE(SideAssist::Qt::Payload::readValue(buf, value, &error))
+          << qPrintable(error);
+      EXPECT_EQ(value, input);
+    }
+  }
+}
+
+TEST(Payload, ReadMalformed) {
+  QJsonValue value;
+  EXPECT_FALSE(SideAssist::Qt::Payload::readValue("{\"value\":", value));
+  EXPECT_FALSE(
+      SideAssist::Qt::Payload::readValue(QByteArray("\xd9\xd9\xf7\x01"), value));
+  EXPECT_TRUE(SideAssist::Qt::Payload::readValue("{\"other\":1}", value));
+  EXPECT_TRUE(value.isUndefined());
+}
+
+TEST(Payload, Compression) {
+  QJsonArray arr;
+  for (int i = 0; i < 4096; ++i)
+    arr.append(i % 7);
+  QByteArray buf;
+  SideAssist::Qt::Payload::writeValue(arr, buf);
+  auto compressed = SideAssist::Qt::Payload::compress(buf);
+  EXPECT_TRUE(SideAssist::Qt::Payload::isCompressed(compressed));
+  EXPECT_FALSE(SideAssist::Qt::Payload::isCompressed(buf));
+  EXPECT_LT(compressed.size(), buf.size());
+
+  QJsonValue value;
+  EXPECT_TRUE(SideAssist::Qt::Payload::readValue(compressed, value));
+  EXPECT_EQ(value, QJsonValue(arr));
+
+  QByteArray out;
+  EXPECT_FALSE(SideAssist::Qt::Payload::decompress(compressed, out,
+                                                    buf.size() - 1));
+  EXPECT_TRUE(
+      SideAssist::Qt::Payload::decompress(compressed, out, buf.size()));
+  EXPECT_EQ(out, buf);
+
+  // A forged header must not let the body expand past max_size
+  auto forged = compressed;
+  const char small_size[] = {0, 0, 0, 16};
+  forged.replace(4, 4, small_size, 4);
+  QString error;
+  EXPECT_FALSE(
+      SideAssist::Qt::Payload::decompress(forged, out, 64, &error));
+  EXPECT_FALSE(error.isEmpty());
+  EXPECT_LE(out.size(), 64);
+  EXPECT_FALSE(SideAssist::Qt::Payload::decompress(forged, out, buf.size()));
+}
+
+TEST(Payload, CompressedBomb) {
+  // 16 MiB of spaces deflate to a few KiB
+  QByteArray buf;
+  SideAssist::Qt::Payload::writeValue(QString(16 * 1024 * 1024 - 16, ' '),
+                                      buf);
+  auto bomb = SideAssist::Qt::Payload::compress(buf);
+  ASSERT_LT(bomb.size(), 64 * 1024);
+
+  const qsizetype limit = 1024 * 1024;
+  QJsonValue value;
+  QString error;
+  EXPECT_FALSE(
+      SideAssist::Qt::Payload::readValue(bomb, value, &error, limit));
+  EXPECT_FALSE(error.isEmpty());
+
+  // Same with a header claiming it fits
+  const char small_size[] = {0, 0, 0, 16};
+  bomb.replace(4, 4, small_size, 4);
+  QByteArray out;
+  EXPECT_FALSE(SideAssist::Qt::Payload::decompress(bomb, out, limit, &error));
+  EXPECT_EQ(error, QString("Decompressed size exceeds %1").arg(limit));
+
+  // Logging the rejected payload must not inflate it either
+  EXPECT_EQ(SideAssist::Qt::Payload::toDisplayString(bomb),
+            QString("<%1 bytes compressed>").arg(bomb.size()));
+}
+
+TEST(Payload, DisplayStringIsBounded) {
+  QJsonArray arr;
+  for (int i = 0; i < 4096; ++i)
+    arr.append(i);
+  QByteArray buf;
+  SideAssist::Qt::Payload::writeValue(
+      arr, buf, SideAssist::Qt::Payload::Encoding::Cbor);
+  auto str = SideAssist::Qt::Payload::toDisplayString(buf);
+  EXPECT_TRUE(str.startsWith("55799(")) << qPrintable(str);
+  EXPECT_TRUE(str.endsWith("...")) << qPrintable(str);
+  EXPECT_LE(str.length(), 256);
+}
+
+TEST(Payload, ReadScalarMatchesDocument) {
+  const char* payloads[] = {
+      R"({"value":42})",
+      R"( { "value" : -12748941 } )",
+      "{\n\t\"value\":\r\n2.5e-3}",
+      R"({"value":-0})",
+      R"({"value":9223372036854775807})",
+      R"({"value":9223372036854775808})",
+      R"({"value":1e300})",
+      R"({"value":true})",
+      R"({"value":false})",
+      R"({"value":null})",
+      R"({"value":""})",
+      R"({"value":"plain"})",
+      R"({"value":"esc \"quoted\" \\ \/ \b\f\n\r\t"})",
+  };
+  for (const char* payload : payloads) {
+    QJsonValue fast;
+    ASSERT_TRUE(SideAssist::Qt::Payload::readScalarValue(payload, fast))
+        << payload;
+    auto doc = QJsonDocument::fromJson(payload);
+    EXPECT_EQ(fast, doc["value"]) << payload;
+    EXPECT_EQ(fast.type(), doc["value"].type()) << payload;
+  }
+}
+
+TEST(Payload, ReadScalarFallsBack) {
+  const char* payloads[] = {
+      R"({"value":[1,2]})",
+      R"({"value":{"a":1}})",
+      R"({"value":1,"other":2})",
+      R"({"other":1})",
+      "{\"value\":\"\xc3\xa9\"}",
+      R"({"value":01})",
+      R"({"value":1.})",
+      R"({"value":tru})",
+      R"({"value":1} trailing)",
+      R"({"value":"unterminated})",
+      R"([1])",
+      "",
+  };
+  for (const char* payload : payloads) {
+    QJsonValue value;
+    EXPECT_FALSE(SideAssist::Qt::Payload::readScalarValue(payload, value))
+        << payload;
+  }
+
+  // readValue still handles them through QJsonDocument
+  QJsonValue value;
+  ASSERT_TRUE(SideAssist::Qt::Payload::readValue(
+      "{\"value\":\"\xc3\xa9\"}", value));
+  EXPECT_EQ(value, QJsonValue(QString::fromUtf8("\xc3\xa9")));
+  ASSERT_TRUE(
+      SideAssist::Qt::Payload::readValue(R"({"value":[1,2]})", value));
+  EXPECT_EQ(value, QJsonValue(QJsonArray({1, 2})));
+}
@@ -0,0 +1,62 @@
+#include <gtest/gtest.h>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <thread>
+#include "tracer.hpp"
+
+using SideAssist::Qt::Tracer;
+
+static QJsonArray traceEvents() {
+  auto doc = QJsonDocument::fromJson(Tracer::toChromeTraceJson());
+  EXPECT_TRUE(doc.isObject());
+  return doc.object()["traceEvents"].toArray();
+}
+
+TEST(Tracer, DisabledRecordsNothing) {
+  Tracer::clear();
+  Tracer::setEnabled(false);
+  { SIDE_ASSIST_TRACE_SCOPE("disabled"); }
+  EXPECT_TRUE(traceEvents().isEmpty());
+}
+
+TEST(Tracer, SpansFromSeveralThreads) {
+  Tracer::clear();
+  Tracer::setEnabled(true);
+  {
+    SIDE_ASSIST_TRACE_SCOPE("outer");
+    SIDE_ASSIST_TRACE_SCOPE("inner \"quoted\"");
+  }
+  std::thread([]() { SIDE_ASSIST_TRACE_SCOPE("worker"); }).join();
+  Tracer::setEnabled(false);
+
+  auto events = traceEvents();
+  ASSERT_EQ(events.size(), 3);
+  // Inner spans end, and are recorded, first
+  auto inner = events[0].toObject();
+  auto outer = events[1].toObject();
+  auto worker = events[2].toObject();
+  EXPECT_EQ(inner["name"].toString(), "inner \"quoted\"");
+  EXPECT_EQ(inner["ph"].toString(), "X");
+  EXPECT_EQ(outer["name"].toString(), "outer");
+  EXPECT_LE(outer["ts"].toDouble(), inner["ts"].toDouble());
+  EXPECT_GE(outer["dur"].toDouble(), inner["dur"].toDouble());
+  EXPECT_EQ(worker["name"].toString(), "worker");
+  EXPECT_NE(worker["tid"].toInt(), outer["tid"].toInt());
+}
+
+TEST(Tracer, FullBufferDropsSpans) {
+  Tracer::clear();
+  Tracer::setBufferCapacity(2);
+  Tracer::setEnabled(true);
+  // A new thread picks up the new capacity
+  std::thread([]() {
+    for (int i = 0; i < 5; ++i)
+      SIDE_ASSIST_TRACE_SCOPE("span");
+  }).join();
+  Tracer::setEnabled(false);
+  Tracer::setBufferCapacity(65536);
+
+  EXPECT_EQ(traceEvents().size(), 2);
+  EXPECT_EQ(Tracer::droppedEvents(), 3u);
+}
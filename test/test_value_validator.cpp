@@ -2,6 +2,7 @@
 #include <QDir>
 #include <QFileInfo>
 #include <QJsonArray>
+#include <QJsonDocument>
 #include <QJsonObject>
 #include "value_validator.hpp"
 
@@ -179,3 +180,146 @@ TEST(ValueValidator, ReadOnlyFilePath) {
       val, &is_this_type);
   EXPECT_TRUE(is_this_type);
 }
+
+TEST(ValueValidator, SerializedCache) {
+  namespace Validator = SideAssist::Qt::ValueValidator;
+  auto ptr = std::make_shared<Validator::Option>(
+      std::set<QString>{"One", "Two", "Three"});
+  auto same = std::make_shared<Validator::Option>(
+      std::set<QString>{"Three", "Two", "One"});
+  auto other = std::make_shared<Validator::Option>(
+      std::set<QString>{"One", "Two"});
+
+  auto doc = QJsonDocument::fromJson(ptr->serializedPayload());
+  EXPECT_EQ(doc["validator"], ptr->serializeToJson());
+  // Memoized
+  EXPECT_EQ(ptr->serializedPayload().constData(),
+            ptr->serializedPayload().constData());
+
+  EXPECT_EQ(ptr->digest().size(), 20);
+  EXPECT_EQ(ptr->digest(), same->digest());
+  EXPECT_NE(ptr->digest(), other->digest());
+}
+
+TEST(ValueValidator, ListItem) {
+  namespace Validator = SideAssist::Qt::ValueValidator;
+  auto integers = QJsonObject(
+      {qMakePair("types", QJsonArray({QJsonValue("Integer")}))});
+  auto ptr = Validator::Abstract::deserializeFromJson(
+      QJsonObject({qMakePair("list", integers)}));
+  ASSERT_NE(ptr, nullptr);
+  EXPECT_TRUE(ptr->validate(QJsonArray({1, 2})));
+  EXPECT_TRUE(ptr->validate(QJsonArray()));
+  EXPECT_FALSE(ptr->validate(QJsonArray({1, "text"})));
+  EXPECT_FALSE(ptr->validate(QJsonValue(1)));
+
+  auto round_trip =
+      Validator::Abstract::deserializeFromJson(ptr->serializeToJson());
+  ASSERT_NE(round_trip, nullptr);
+  EXPECT_EQ(round_trip->serializeToJson(), ptr->serializeToJson());
+  EXPECT_FALSE(round_trip->validate(QJsonArray({2.5})));
+
+  // An invalid item validator invalidates the list
+  EXPECT_EQ(Validator::Abstract::deserializeFromJson(QJsonObject(
+                {qMakePair("list", QJsonObject({qMakePair("unknown", 1)}))})),
+            nullptr);
+}
+
+TEST(ValueValidator, ProgramMatchesTree) {
+  namespace Validator = SideAssist::Qt::ValueValidator;
+  using List = std::list<std::shared_ptr<Validator::Abstract>>;
+  auto integer = std::make_shared<Validator::SingleType>(
+      Validator::ValueTypeFieldEnum::Integer);
+  auto null_or_bool = std::make_shared<Validator::Types>(
+      std::initializer_list<QJsonValue::Type>{QJsonValue::Null,
+                                              QJsonValue::Bool});
+  auto option = std::make_shared<Validator::Option>(
+      std::set<QString>{"One", "Two"});
+  auto prefix =
+      std::make_shared<Validator::StringPrefix>(std::set<QString>{"/tmp/"});
+  auto suffix =
+      std::make_shared<Validator::StringSuffix>(std::set<QString>{".txt"});
+  auto path = Validator::Path::ExistedDir();
+  auto strings = std::make_shared<Validator::ListItem>(
+      std::make_shared<Validator::Any>(List{option, prefix}));
+
+  std::vector<std::shared_ptr<Validator::Abstract>> validators = {
+      std::make_shared<Validator::Dummy>(),
+      integer,
+      null_or_bool,
+      option,
+      prefix,
+      suffix,
+      path,
+      strings,
+      std::make_shared<Validator::Any>(List{}),
+      std::make_shared<Validator::All>(List{}),
+      std::make_shared<Validator::Any>(List{integer, null_or_bool, option}),
+      std::make_shared<Validator::All>(List{prefix, suffix}),
+      std::make_shared<Validator::All>(
+          List{std::make_shared<Validator::Any>(List{null_or_bool, strings}),
+               std::make_shared<Validator::Any>(List{suffix, strings})}),
+      std::make_shared<Validator::ListItem>(strings),
+  };
+  std::vector<QJsonValue> values = {
+      QJsonValue(),
+      QJsonValue(true),
+      QJsonValue(12),
+      QJsonValue(-1),
+      QJsonValue(2.5),
+      QJsonValue("One"),
+      QJsonValue("Three"),
+      QJsonValue("/tmp/a.txt"),
+      QJsonValue(QDir::tempPath()),
+      QJsonArray(),
+      QJsonArray({"One", "/tmp/b"}),
+      QJsonArray({"One", 3}),
+      QJsonArray({QJsonArray({"Two"}), QJsonArray()}),
+      QJsonObject(),
+  };
+
+  for (size_t i = 0; i < validators.size(); ++i) {
+    for (size_t j = 0; j < values.size(); ++j) {
+      EXPECT_EQ(validators[i]->program().run(values[j]),
+                validators[i]->validate(values[j]))
+          << "validator " << i << ", value " << j;
+    }
+  }
+}
+
+TEST(ValueValidator, ProgramShape) {
+  namespace Validator = SideAssist::Qt::ValueValidator;
+  using List = std::list<std::shared_ptr<Validator::Abstract>>;
+  using Opcode = Validator::Program::Opcode;
+  auto null = std::make_shared<Validator::SingleType>(
+      Validator::ValueTypeFieldEnum::Null);
+  auto integer = std::make_shared<Validator::SingleType>(
+      Validator::ValueTypeFieldEnum::Integer);
+  auto option =
+      std::make_shared<Validator::Option>(std::set<QString>{"One"});
+
+  // Type masks in one Any fold into a single test
+  Validator::Any types(List{null, integer});
+  const auto& folded = types.program().instructions();
+  ASSERT_EQ(folded.size(), 2u);
+  EXPECT_EQ(folded[0].op, Opcode::TypeMask);
+  EXPECT_EQ(folded[0].operand,
+            quint32(Validator::ValueTypeFieldEnum::Null) |
+                quint32(Validator::ValueTypeFieldEnum::Integer));
+  // Memoized
+  EXPECT_EQ(&types.program(), &types.program());
+
+  // Every branch but the last jumps past the rest
+  Validator::All all(List{option, integer, null});
+  const auto& jumps = all.program().instructions();
+  ASSERT_EQ(jumps.size(), 6u);
+  EXPECT_EQ(jumps[1].op, Opcode::JumpIfFalse);
+  EXPECT_EQ(jumps[1].operand, 5u);
+  EXPECT_EQ(jumps[3].op, Opcode::JumpIfFalse);
+  EXPECT_EQ(jumps[3].operand, 5u);
+  EXPECT_EQ(jumps[5].op, Opcode::Return);
+
+  // Validators without a lowering are called
+  auto path = Validator::Path::ExistedDir();
+  EXPECT_EQ(path->program().instructions()[0].op, Opcode::Call);
+}